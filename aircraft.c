@@ -0,0 +1,231 @@
+// Part of readsbmqtt, an MQTT client that reads statistics from readsb
+// ADS-B decoder and forward them via MQTT broker into home assistant (HASS)
+//
+// aircraft.c: Aircraft state from readsb aircraft.pb.
+//
+// Copyright (c) 2022 Michael Wolf <michael@mictronics.de>
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <stdlib.h>
+#include <string.h>
+#include "aircraft.h"
+#include "fmt.h"
+
+static const char HEX[] = "0123456789abcdef";
+static const char HEX_UPPER[] = "0123456789ABCDEF";
+
+/**
+ * Find slot of address in table.
+ * @param table Hash table.
+ * @param mask Table size - 1.
+ * @param key Address + 1.
+ * @return Slot holding the key, or empty slot where it belongs.
+ */
+static struct aircraft_slot *find(struct aircraft_slot *table, size_t mask, uint32_t key) {
+    size_t i = (key * 2654435761u) & mask;
+    while (table[i].key && table[i].key != key) {
+        i = (i + 1) & mask;
+    }
+    return &table[i];
+}
+
+/**
+ * Initialize tracker.
+ * @param tracker Tracker.
+ * @return Zero on success, -1 when out of memory.
+ */
+int aircraft_tracker_init(struct aircraft_tracker *tracker) {
+    tracker->size = AIRCRAFT_MIN_SLOTS;
+    tracker->current = calloc(tracker->size, sizeof (struct aircraft_slot));
+    tracker->previous = calloc(tracker->size, sizeof (struct aircraft_slot));
+    return tracker->current && tracker->previous ? 0 : -1;
+}
+
+/**
+ * Make room for a frame, keeping the table at most half full.
+ * Must be called before the first update of a frame.
+ * @param tracker Tracker.
+ * @param count Number of aircraft in frame.
+ * @return Zero on success, -1 when out of memory.
+ */
+int aircraft_tracker_reserve(struct aircraft_tracker *tracker, size_t count) {
+    size_t size = tracker->size;
+    while (size < count * 2) {
+        size *= 2;
+    }
+    if (size == tracker->size) {
+        return 0;
+    }
+
+    struct aircraft_slot *current = calloc(size, sizeof (struct aircraft_slot));
+    struct aircraft_slot *previous = calloc(size, sizeof (struct aircraft_slot));
+    if (current == NULL || previous == NULL) {
+        free(current);
+        free(previous);
+        return -1;
+    }
+    // Keep last frame for change detection.
+    for (size_t i = 0; i < tracker->size; ++i) {
+        if (tracker->previous[i].key) {
+            *find(previous, size - 1, tracker->previous[i].key) = tracker->previous[i];
+        }
+    }
+    free(tracker->current);
+    free(tracker->previous);
+    tracker->current = current;
+    tracker->previous = previous;
+    tracker->size = size;
+    return 0;
+}
+
+/**
+ * Record aircraft of current frame.
+ * @param tracker Tracker.
+ * @param addr Aircraft address.
+ * @param messages Number of messages received from aircraft.
+ * @return Non zero when aircraft is new or got messages since previous frame.
+ */
+int aircraft_tracker_update(struct aircraft_tracker *tracker, uint32_t addr, uint64_t messages) {
+    size_t mask = tracker->size - 1;
+    uint32_t key = addr + 1;
+    struct aircraft_slot *prev = find(tracker->previous, mask, key);
+    struct aircraft_slot *cur = find(tracker->current, mask, key);
+
+    cur->key = key;
+    cur->messages = messages;
+    return prev->key == 0 || prev->messages != messages;
+}
+
+/**
+ * Finish frame, current frame becomes previous.
+ * @param tracker Tracker.
+ */
+void aircraft_tracker_next(struct aircraft_tracker *tracker) {
+    struct aircraft_slot *prev = tracker->previous;
+    tracker->previous = tracker->current;
+    tracker->current = prev;
+    memset(tracker->current, 0, tracker->size * sizeof (struct aircraft_slot));
+}
+
+void aircraft_tracker_destroy(struct aircraft_tracker *tracker) {
+    free(tracker->current);
+    free(tracker->previous);
+    tracker->current = NULL;
+    tracker->previous = NULL;
+    tracker->size = 0;
+}
+
+/**
+ * Format aircraft address as 6 hex digits, '~' prefix for non-ICAO.
+ * @param buf Output buffer, at least AIRCRAFT_HEX_SIZE bytes.
+ * @param addr Aircraft address.
+ * @return Number of characters written, without NUL termination.
+ */
+size_t aircraft_hex(char *buf, uint32_t addr) {
+    char *p = buf;
+    if (addr & AIRCRAFT_NON_ICAO) {
+        *p++ = '~';
+    }
+    for (int shift = 20; shift >= 0; shift -= 4) {
+        *p++ = HEX[(addr >> shift) & 0xf];
+    }
+    *p = '\0';
+    return (size_t) (p - buf);
+}
+
+/**
+ * Write integer member.
+ * @param json Writer.
+ * @param key Member key.
+ * @param value Value.
+ */
+static void member_int(struct json *json, const char *key, int64_t value) {
+    char buf[FMT_BUF_SIZE];
+    size_t len = fmt_i64(buf, value);
+    json_member_raw(json, key, buf, len);
+}
+
+/**
+ * Write real number member.
+ * @param json Writer.
+ * @param key Member key.
+ * @param value Value.
+ * @param decimals Number of decimals.
+ */
+static void member_fixed(struct json *json, const char *key, double value, int decimals) {
+    char buf[FMT_BUF_SIZE];
+    size_t len = fmt_fixed(buf, value, decimals);
+    json_member_raw(json, key, buf, len);
+}
+
+/**
+ * Build JSON state of one aircraft. Fields without valid source are omitted.
+ * @param json Writer.
+ * @param a Aircraft.
+ */
+void aircraft_json(struct json *json, const AircraftMeta *a) {
+    const AircraftMeta__ValidSource *valid = a->valid_source;
+    char buf[FMT_BUF_SIZE];
+
+    json_object_begin(json);
+    aircraft_hex(buf, a->addr);
+    json_member_string(json, "hex", buf);
+    if ((!valid || valid->callsign) && a->flight && a->flight[0]) {
+        // Callsign is padded with spaces
+        size_t len = strnlen(a->flight, 8);
+        while (len && a->flight[len - 1] == ' ') {
+            len--;
+        }
+        memcpy(buf, a->flight, len);
+        buf[len] = '\0';
+        json_member_string(json, "flight", buf);
+    }
+    if (!valid || valid->squawk) {
+        // Four octal digits stored as hex nibbles
+        char sq[5] = {HEX[(a->squawk >> 12) & 0xf], HEX[(a->squawk >> 8) & 0xf],
+            HEX[(a->squawk >> 4) & 0xf], HEX[a->squawk & 0xf], '\0'};
+        json_member_string(json, "squawk", sq);
+    }
+    if (a->category) {
+        // Emitter category A0 - D7 stored as hex
+        char cat[3] = {HEX_UPPER[(a->category >> 4) & 0xf], HEX_UPPER[a->category & 0xf], '\0'};
+        json_member_string(json, "category", cat);
+    }
+    if (a->air_ground == AIRCRAFT_META__AIR_GROUND__AG_GROUND) {
+        json_member_raw(json, "ground", "true", 4);
+    } else if (!valid || valid->altitude) {
+        member_int(json, "alt_baro", a->alt_baro);
+    }
+    if (!valid || valid->alt_geom) {
+        member_int(json, "alt_geom", a->alt_geom);
+    }
+    if (!valid || valid->gs) {
+        member_int(json, "gs", a->gs);
+    }
+    if (!valid || valid->track) {
+        member_int(json, "track", a->track);
+    }
+    if (!valid || valid->baro_rate) {
+        member_int(json, "baro_rate", a->baro_rate);
+    }
+    if (!valid || (valid->lat && valid->lon)) {
+        member_fixed(json, "lat", a->lat, 6);
+        member_fixed(json, "lon", a->lon, 6);
+        member_int(json, "distance", a->distance);
+    }
+    member_fixed(json, "rssi", a->rssi, 1);
+    member_int(json, "messages", (int64_t) a->messages);
+    json_object_end(json);
+}
@@ -0,0 +1,60 @@
+// Part of readsbmqtt, an MQTT client that reads statistics from readsb
+// ADS-B decoder and forward them via MQTT broker into home assistant (HASS)
+//
+// aircraft.h: Aircraft state from readsb aircraft.pb. (header)
+//
+// Copyright (c) 2022 Michael Wolf <michael@mictronics.de>
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef AIRCRAFT_H
+#define AIRCRAFT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "readsb.pb-c.h"
+#include "json.h"
+
+// Readsb marks non-ICAO addresses (e.g. TIS-B) with this bit.
+#define AIRCRAFT_NON_ICAO   0x1000000
+#define AIRCRAFT_HEX_SIZE   8
+#define AIRCRAFT_MIN_SLOTS  1024
+
+// Message count of one aircraft in a frame, key is address + 1 so 0 marks empty slots
+struct aircraft_slot {
+    uint32_t key;
+    uint64_t messages;
+};
+
+/*
+ * Detects aircraft with new messages since the previous frame. Two
+ * open-addressing tables are swapped per frame, aircraft that left the
+ * frame drop out without tombstones. Tables only grow, there is no
+ * allocation after warm-up.
+ */
+struct aircraft_tracker {
+    struct aircraft_slot *current;
+    struct aircraft_slot *previous;
+    size_t size; // Slots per table, power of two
+};
+
+int aircraft_tracker_init(struct aircraft_tracker *tracker);
+int aircraft_tracker_reserve(struct aircraft_tracker *tracker, size_t count);
+int aircraft_tracker_update(struct aircraft_tracker *tracker, uint32_t addr, uint64_t messages);
+void aircraft_tracker_next(struct aircraft_tracker *tracker);
+void aircraft_tracker_destroy(struct aircraft_tracker *tracker);
+size_t aircraft_hex(char *buf, uint32_t addr);
+void aircraft_json(struct json *json, const AircraftMeta *a);
+
+#endif /* AIRCRAFT_H */
@@ -0,0 +1,118 @@
+// Part of readsbmqtt, an MQTT client that reads statistics from readsb
+// ADS-B decoder and forward them via MQTT broker into home assistant (HASS)
+//
+// arena.c: Bump allocator for protobuf-c message unpacking.
+//
+// Copyright (c) 2022 Michael Wolf <michael@mictronics.de>
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <stdlib.h>
+#include "arena.h"
+
+#define ALIGN_UP(N) (((N) + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1))
+
+/**
+ * Allocate memory from arena.
+ * @param allocator_data Arena.
+ * @param size Number of bytes.
+ * @return Pointer to memory or NULL when out of memory.
+ */
+static void *arena_alloc(void *allocator_data, size_t size) {
+    struct arena *arena = (struct arena *) allocator_data;
+    size = ALIGN_UP(size);
+
+    if (arena->used + size <= arena->size) {
+        void *p = arena->base + arena->used;
+        arena->used += size;
+        return p;
+    }
+
+    // Block exhausted, serve from heap until next reset.
+    struct arena_block *block = malloc(sizeof (struct arena_block) + size);
+    if (block == NULL) {
+        return NULL;
+    }
+    arena->heap_allocs++;
+    block->next = arena->overflow;
+    arena->overflow = block;
+    arena->used += size;
+    return block->data;
+}
+
+/**
+ * Arena memory is released at once by arena_reset().
+ * @param allocator_data Arena.
+ * @param pointer Memory to free.
+ */
+static void arena_free(void *allocator_data, void *pointer) {
+    (void) allocator_data;
+    (void) pointer;
+}
+
+/**
+ * Initialize arena.
+ * @param arena Arena.
+ * @param size Initial block size.
+ * @return Zero on success, -1 when out of memory.
+ */
+int arena_init(struct arena *arena, size_t size) {
+    arena->allocator.alloc = arena_alloc;
+    arena->allocator.free = arena_free;
+    arena->allocator.allocator_data = arena;
+    arena->size = ALIGN_UP(size);
+    arena->used = 0;
+    arena->overflow = NULL;
+    arena->peak = 0;
+    arena->heap_allocs = 1;
+    arena->base = malloc(arena->size);
+    return arena->base ? 0 : -1;
+}
+
+/**
+ * Release all memory allocated from arena since last reset.
+ * Grows the block to peak usage when the last cycle overflowed.
+ * @param arena Arena.
+ */
+void arena_reset(struct arena *arena) {
+    if (arena->used > arena->peak) {
+        arena->peak = arena->used;
+    }
+    if (arena->overflow) {
+        while (arena->overflow) {
+            struct arena_block *next = arena->overflow->next;
+            free(arena->overflow);
+            arena->overflow = next;
+        }
+        unsigned char *base = malloc(arena->peak);
+        if (base) {
+            free(arena->base);
+            arena->base = base;
+            arena->size = arena->peak;
+            arena->heap_allocs++;
+        }
+    }
+    arena->used = 0;
+}
+
+/**
+ * Free all arena memory.
+ * @param arena Arena.
+ */
+void arena_destroy(struct arena *arena) {
+    arena_reset(arena);
+    free(arena->base);
+    arena->base = NULL;
+    arena->size = 0;
+}
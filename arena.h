@@ -0,0 +1,57 @@
+// Part of readsbmqtt, an MQTT client that reads statistics from readsb
+// ADS-B decoder and forward them via MQTT broker into home assistant (HASS)
+//
+// arena.h: Bump allocator for protobuf-c message unpacking. (header)
+//
+// Copyright (c) 2022 Michael Wolf <michael@mictronics.de>
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <protobuf-c/protobuf-c.h>
+
+#define ARENA_ALIGN 16
+
+// Overflow block, used when the arena block is exhausted during one cycle
+struct arena_block {
+    struct arena_block *next;
+    unsigned char data[] __attribute__ ((aligned(ARENA_ALIGN)));
+};
+
+/*
+ * Allocations are bumped from one block and never freed individually.
+ * The whole arena is released with arena_reset() after the unpacked
+ * message is no longer used. When a cycle needs more than the block,
+ * the overflow is served from the heap and the block is grown to the
+ * peak size on the next reset. After warm-up no heap allocation occurs.
+ */
+struct arena {
+    ProtobufCAllocator allocator; // Pass &arena->allocator to *__unpack()
+    unsigned char *base;
+    size_t size; // Block size
+    size_t used; // Bytes used in current cycle, including overflow
+    struct arena_block *overflow;
+    size_t peak; // Maximum bytes used in one cycle
+    uint64_t heap_allocs; // Number of heap allocations done by the arena
+};
+
+int arena_init(struct arena *arena, size_t size);
+void arena_reset(struct arena *arena);
+void arena_destroy(struct arena *arena);
+
+#endif /* ARENA_H */
@@ -0,0 +1,653 @@
+// Part of readsbmqtt, an MQTT client that reads statistics from readsb
+// ADS-B decoder and forward them via MQTT broker into home assistant (HASS)
+//
+// bench/broker.c: Minimal MQTT 3.1.1 stand-in broker for tests and benchmarks.
+//
+// Copyright (c) 2022 Michael Wolf <michael@mictronics.de>
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/*
+ * Listens on localhost only. Accepts CONNECT, PUBLISH, SUBSCRIBE,
+ * UNSUBSCRIBE and PINGREQ, acknowledges QoS 1 and 2 and forwards
+ * publications to matching subscribers at QoS 0. Retained messages and
+ * wills are not stored. Every packet sent by the broker is held back by
+ * the configured delay plus jitter, order per connection is kept.
+ * A connection can be dropped after every n-th PUBLISH to test reconnects.
+ * Every received packet is recorded with a timestamp, a summary of
+ * packet counts and bytes is printed on exit.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <argp.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+
+#define MAX_CLIENTS         64
+#define MAX_SUBSCRIPTIONS   16
+#define MAX_PACKET_SIZE     (1024 * 1024)
+#define MAX_EVENTS          16
+#define LISTEN_ID           MAX_CLIENTS
+#define SIGNAL_ID           (MAX_CLIENTS + 1)
+#define NUM_PACKET_TYPES    16
+
+// Packet queued for sending at due time
+struct packet_out {
+    struct packet_out *next;
+    uint64_t due;
+    size_t len;
+    size_t off;
+    uint8_t data[];
+};
+
+struct conn {
+    int fd;
+    char client_id[64];
+    uint8_t *in;
+    size_t in_len;
+    size_t in_size;
+    struct packet_out *head;
+    struct packet_out *tail;
+    char *subs[MAX_SUBSCRIPTIONS];
+    int num_subs;
+    unsigned publishes;
+    int blocked; // Socket full, waiting for EPOLLOUT
+};
+
+// Received packets and bytes per packet type
+struct packet_stats {
+    uint64_t count;
+    uint64_t bytes;
+};
+
+static struct {
+    int port;
+    int delay;
+    int jitter;
+    unsigned drop_every;
+    const char *record;
+    int duration;
+} opt = {18830, 0, 0, 0, NULL, 0};
+
+static const char *packet_names[NUM_PACKET_TYPES] = {
+    "RESERVED", "CONNECT", "CONNACK", "PUBLISH", "PUBACK", "PUBREC", "PUBREL", "PUBCOMP",
+    "SUBSCRIBE", "SUBACK", "UNSUBSCRIBE", "UNSUBACK", "PINGREQ", "PINGRESP", "DISCONNECT", "AUTH"
+};
+
+static struct conn conns[MAX_CLIENTS];
+static struct packet_stats received[NUM_PACKET_TYPES];
+static uint64_t payload_bytes;
+static uint64_t forwarded;
+static unsigned connections;
+static unsigned drops;
+static uint64_t start_time;
+static int epoll_fd = -1;
+static FILE *record_file;
+
+static struct argp_option options[] = {
+    {"port", 'l', "<port>", 0, "TCP port on localhost (default: 18830)", 1},
+    {"delay", 'd', "<ms>", 0, "Delay of every packet sent by the broker (default: 0)", 1},
+    {"jitter", 'j', "<ms>", 0, "Random jitter added to the delay, +/- (default: 0)", 1},
+    {"drop", 'D', "<n>", 0, "Drop the client connection after every n-th PUBLISH (default: 0, never)", 1},
+    {"record", 'o', "<file>", 0, "Record every received packet with timestamp, - for stdout", 1},
+    {"time", 'T', "<seconds>", 0, "Exit after this time (default: 0, run until signalled)", 1},
+    { 0}
+};
+
+static error_t parse_opt(int key, char *arg, struct argp_state *state) {
+    (void) state;
+    switch (key) {
+        case 'l':
+            opt.port = atoi(arg);
+            break;
+        case 'd':
+            opt.delay = atoi(arg);
+            break;
+        case 'j':
+            opt.jitter = atoi(arg);
+            break;
+        case 'D':
+            opt.drop_every = (unsigned) atoi(arg);
+            break;
+        case 'o':
+            opt.record = arg;
+            break;
+        case 'T':
+            opt.duration = atoi(arg);
+            break;
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+}
+
+static void watch(int fd, uint32_t id, uint32_t events, int op) {
+    struct epoll_event ev = {.events = events, .data.u32 = id};
+    epoll_ctl(epoll_fd, op, fd, &ev);
+}
+
+/**
+ * Queue packet for sending after delay and jitter. Due time never goes
+ * before the previous packet, so the order on the wire is kept.
+ * @param c Connection.
+ * @param data Complete packet.
+ * @param len Packet length.
+ */
+static void send_packet(struct conn *c, const uint8_t *data, size_t len) {
+    struct packet_out *p = malloc(sizeof (struct packet_out) + len);
+    if (p == NULL) {
+        return;
+    }
+    int64_t delay = (int64_t) opt.delay * 1000;
+    if (opt.jitter > 0) {
+        delay += (int64_t) (rand() % (2 * opt.jitter * 1000 + 1)) - opt.jitter * 1000;
+    }
+    p->due = now_us() + (uint64_t) (delay > 0 ? delay : 0);
+    if (c->tail && c->tail->due > p->due) {
+        p->due = c->tail->due;
+    }
+    p->next = NULL;
+    p->len = len;
+    p->off = 0;
+    memcpy(p->data, data, len);
+    if (c->tail) {
+        c->tail->next = p;
+    } else {
+        c->head = p;
+    }
+    c->tail = p;
+}
+
+/**
+ * Queue packet with packet identifier only, e.g. PUBACK.
+ */
+static void send_ack(struct conn *c, uint8_t header, const uint8_t *id) {
+    uint8_t ack[4] = {header, 2, id[0], id[1]};
+    send_packet(c, ack, sizeof (ack));
+}
+
+static void close_conn(struct conn *c) {
+    if (c->fd == -1) {
+        return;
+    }
+    close(c->fd);
+    c->fd = -1;
+    while (c->head) {
+        struct packet_out *next = c->head->next;
+        free(c->head);
+        c->head = next;
+    }
+    c->tail = NULL;
+    for (int i = 0; i < c->num_subs; ++i) {
+        free(c->subs[i]);
+    }
+    c->num_subs = 0;
+    free(c->in);
+    c->in = NULL;
+    c->in_len = c->in_size = 0;
+}
+
+/**
+ * Write due packets of connection.
+ * @return Zero when all due packets are written, 1 when socket is full, -1 on error.
+ */
+static int flush_conn(struct conn *c, uint64_t now) {
+    while (c->head && c->head->due <= now) {
+        struct packet_out *p = c->head;
+        ssize_t n = write(c->fd, p->data + p->off, p->len - p->off);
+        if (n == -1) {
+            return errno == EAGAIN ? 1 : -1;
+        }
+        p->off += (size_t) n;
+        if (p->off < p->len) {
+            return 1;
+        }
+        c->head = p->next;
+        if (c->head == NULL) {
+            c->tail = NULL;
+        }
+        free(p);
+    }
+    return 0;
+}
+
+/**
+ * Match topic against subscription filter with + and # wildcards.
+ */
+static int topic_match(const char *filter, const char *topic, size_t len) {
+    const char *end = topic + len;
+    for (;;) {
+        if (filter[0] == '#') {
+            return 1;
+        }
+        if (filter[0] == '+') {
+            while (topic < end && *topic != '/') {
+                topic++;
+            }
+            filter++;
+        } else {
+            while (*filter && *filter != '/' && topic < end && *topic == *filter) {
+                filter++;
+                topic++;
+            }
+            if ((*filter && *filter != '/') || (topic < end && *topic != '/')) {
+                return 0;
+            }
+        }
+        // Both at end of level
+        if (*filter == '\0') {
+            return topic == end;
+        }
+        if (topic == end) {
+            // "a/#" matches "a" as well
+            return strcmp(filter, "/#") == 0;
+        }
+        filter++;
+        topic++;
+    }
+}
+
+/**
+ * Forward publication at QoS 0 to all subscribers.
+ */
+static void forward(const uint8_t *topic, size_t topic_len, const uint8_t *payload, size_t payload_len) {
+    size_t rem = 2 + topic_len + payload_len;
+    uint8_t *packet = malloc(rem + 5);
+    size_t len = 0;
+    char name[65536];
+
+    if (packet == NULL) {
+        return;
+    }
+    memcpy(name, topic, topic_len);
+    name[topic_len] = '\0';
+    packet[len++] = 0x30;
+    do {
+        packet[len++] = (uint8_t) ((rem & 0x7f) | (rem > 0x7f ? 0x80 : 0));
+        rem >>= 7;
+    } while (rem);
+    packet[len++] = (uint8_t) (topic_len >> 8);
+    packet[len++] = (uint8_t) topic_len;
+    memcpy(packet + len, topic, topic_len);
+    len += topic_len;
+    memcpy(packet + len, payload, payload_len);
+    len += payload_len;
+    for (int i = 0; i < MAX_CLIENTS; ++i) {
+        struct conn *c = &conns[i];
+        for (int s = 0; c->fd != -1 && s < c->num_subs; ++s) {
+            if (topic_match(c->subs[s], name, topic_len)) {
+                send_packet(c, packet, len);
+                forwarded++;
+                break;
+            }
+        }
+    }
+    free(packet);
+}
+
+static uint16_t read_u16(const uint8_t *p) {
+    return (uint16_t) (p[0] << 8 | p[1]);
+}
+
+static void record(const struct conn *c, int type, size_t len) {
+    uint64_t t = now_us() - start_time;
+    if (record_file) {
+        fprintf(record_file, "%" PRIu64 ".%06" PRIu64 " %d %s %zu", t / 1000000, t % 1000000,
+                (int) (c - conns), packet_names[type], len);
+    }
+    received[type].count++;
+    received[type].bytes += len;
+}
+
+/**
+ * Handle one complete packet.
+ * @param c Connection.
+ * @param header First byte of fixed header.
+ * @param body Variable header and payload.
+ * @param len Length of body.
+ * @param size Size of packet with fixed header.
+ * @return Zero on success, -1 to close the connection.
+ */
+static int handle_packet(struct conn *c, uint8_t header, const uint8_t *body, size_t len, size_t size) {
+    int type = header >> 4;
+    uint8_t reply[5];
+
+    record(c, type, size);
+    switch (type) {
+        case 1: // CONNECT: protocol name, level, flags, keep alive, client id
+        {
+            size_t p = len < 2 ? len : 2 + (size_t) read_u16(body) + 4;
+            if (p + 2 > len || p + 2 + (size_t) read_u16(body + p) > len) {
+                return -1;
+            }
+            size_t id_len = read_u16(body + p);
+            if (id_len >= sizeof (c->client_id)) {
+                id_len = sizeof (c->client_id) - 1;
+            }
+            memcpy(c->client_id, body + p + 2, id_len);
+            c->client_id[id_len] = '\0';
+            if (record_file) {
+                fprintf(record_file, " %s", c->client_id);
+            }
+            reply[0] = 0x20;
+            reply[1] = 2;
+            reply[2] = 0;
+            reply[3] = 0;
+            send_packet(c, reply, 4);
+            break;
+        }
+        case 3: // PUBLISH
+        {
+            int qos = (header >> 1) & 3;
+            if (len < 2 || 2 + (size_t) read_u16(body) + (qos ? 2 : 0) > len) {
+                return -1;
+            }
+            size_t topic_len = read_u16(body);
+            size_t hdr = 2 + topic_len + (qos ? 2 : 0);
+            if (record_file) {
+                fprintf(record_file, " qos=%d retain=%d %.*s %zu", qos, header & 1, (int) topic_len, body + 2, len - hdr);
+            }
+            payload_bytes += len - hdr;
+            if (opt.drop_every && ++c->publishes % opt.drop_every == 0) {
+                drops++;
+                return -1;
+            }
+            if (qos == 1) {
+                send_ack(c, 0x40, body + 2 + topic_len);
+            } else if (qos == 2) {
+                send_ack(c, 0x50, body + 2 + topic_len);
+            }
+            forward(body + 2, topic_len, body + hdr, len - hdr);
+            break;
+        }
+        case 6: // PUBREL
+            if (len < 2) {
+                return -1;
+            }
+            send_ack(c, 0x70, body);
+            break;
+        case 8: // SUBSCRIBE: packet id, filters with requested QoS, QoS 0 granted
+        {
+            uint8_t suback[4 + 2 + MAX_SUBSCRIPTIONS];
+            size_t n = 0;
+            if (len < 2) {
+                return -1;
+            }
+            for (size_t p = 2; p + 2 < len && n < MAX_SUBSCRIPTIONS; ++n) {
+                size_t flen = read_u16(body + p);
+                if (p + 2 + flen >= len) {
+                    return -1;
+                }
+                if (c->num_subs < MAX_SUBSCRIPTIONS) {
+                    char *filter = malloc(flen + 1);
+                    if (filter) {
+                        memcpy(filter, body + p + 2, flen);
+                        filter[flen] = '\0';
+                        c->subs[c->num_subs++] = filter;
+                    }
+                }
+                p += 2 + flen + 1;
+            }
+            suback[0] = 0x90;
+            suback[1] = (uint8_t) (2 + n);
+            suback[2] = body[0];
+            suback[3] = body[1];
+            memset(suback + 4, 0, n);
+            send_packet(c, suback, 4 + n);
+            break;
+        }
+        case 10: // UNSUBSCRIBE
+            if (len < 2) {
+                return -1;
+            }
+            for (size_t p = 2; p + 2 <= len;) {
+                size_t flen = read_u16(body + p);
+                if (p + 2 + flen > len) {
+                    return -1;
+                }
+                for (int s = 0; s < c->num_subs; ++s) {
+                    if (strlen(c->subs[s]) == flen && memcmp(c->subs[s], body + p + 2, flen) == 0) {
+                        free(c->subs[s]);
+                        c->subs[s--] = c->subs[--c->num_subs];
+                    }
+                }
+                p += 2 + flen;
+            }
+            send_ack(c, 0xb0, body);
+            break;
+        case 12: // PINGREQ
+            reply[0] = 0xd0;
+            reply[1] = 0;
+            send_packet(c, reply, 2);
+            break;
+        case 14: // DISCONNECT
+            return -1;
+        default: // Acknowledgments of forwarded packets are not expected at QoS 0
+            break;
+    }
+    return 0;
+}
+
+/**
+ * Read from connection and handle all complete packets.
+ * @return Zero on success, -1 to close the connection.
+ */
+static int read_conn(struct conn *c) {
+    if (c->in_size - c->in_len < 4096) {
+        size_t size = c->in_size ? c->in_size * 2 : 8192;
+        uint8_t *in = realloc(c->in, size);
+        if (in == NULL || size > 2 * MAX_PACKET_SIZE) {
+            return -1;
+        }
+        c->in = in;
+        c->in_size = size;
+    }
+    ssize_t n = read(c->fd, c->in + c->in_len, c->in_size - c->in_len);
+    if (n <= 0) {
+        return n == -1 && errno == EAGAIN ? 0 : -1;
+    }
+    c->in_len += (size_t) n;
+
+    size_t pos = 0;
+    while (c->in_len - pos >= 2) {
+        // Remaining length, 1 to 4 bytes of 7 bit
+        size_t rem = 0, i = 1;
+        int shift = 0;
+        do {
+            if (pos + i >= c->in_len) {
+                goto incomplete;
+            }
+            rem |= (size_t) (c->in[pos + i] & 0x7f) << shift;
+            shift += 7;
+        } while ((c->in[pos + i++] & 0x80) && i <= 4);
+        if (rem > MAX_PACKET_SIZE) {
+            return -1;
+        }
+        if (c->in_len - pos < i + rem) {
+            break;
+        }
+        int rc = handle_packet(c, c->in[pos], c->in + pos + i, rem, i + rem);
+        if (record_file) {
+            fputc('\n', record_file);
+        }
+        if (rc == -1) {
+            return -1;
+        }
+        pos += i + rem;
+    }
+incomplete:
+    memmove(c->in, c->in + pos, c->in_len - pos);
+    c->in_len -= pos;
+    return 0;
+}
+
+static void accept_conn(int listen_fd) {
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd == -1) {
+        return;
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    for (int i = 0; i < MAX_CLIENTS; ++i) {
+        if (conns[i].fd == -1) {
+            memset(&conns[i], 0, sizeof (struct conn));
+            conns[i].fd = fd;
+            watch(fd, (uint32_t) i, EPOLLIN, EPOLL_CTL_ADD);
+            connections++;
+            return;
+        }
+    }
+    fprintf(stderr, "too many clients\n");
+    close(fd);
+}
+
+static void summary(void) {
+    printf("broker: %u connections, %u dropped, %" PRIu64 " forwarded\n", connections, drops, forwarded);
+    printf("%-12s %10s %12s\n", "packet", "count", "bytes");
+    for (int t = 0; t < NUM_PACKET_TYPES; ++t) {
+        if (received[t].count) {
+            printf("%-12s %10" PRIu64 " %12" PRIu64 "\n", packet_names[t], received[t].count, received[t].bytes);
+        }
+    }
+    printf("%-12s %10s %12" PRIu64 "\n", "payload", "", payload_bytes);
+}
+
+int main(int argc, char *argv[]) {
+    struct argp argp = {options, parse_opt, "", "Minimal MQTT 3.1.1 broker with delay, jitter and disconnect injection", NULL, NULL, NULL};
+    struct sockaddr_in addr = {.sin_family = AF_INET};
+    struct epoll_event events[MAX_EVENTS];
+    sigset_t mask;
+    int listen_fd = -1, signal_fd = -1, one = 1;
+    int rc = EXIT_FAILURE;
+
+    if (argp_parse(&argp, argc, argv, 0, 0, 0)) {
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < MAX_CLIENTS; ++i) {
+        conns[i].fd = -1;
+    }
+    if (opt.record) {
+        record_file = strcmp(opt.record, "-") == 0 ? stdout : fopen(opt.record, "w");
+        if (record_file == NULL) {
+            fprintf(stderr, "cannot create file %s: %s\n", opt.record, strerror(errno));
+            return EXIT_FAILURE;
+        }
+    }
+    srand(1);
+    start_time = now_us();
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (signal_fd == -1 || listen_fd == -1 || epoll_fd == -1) {
+        fprintf(stderr, "setup error: %s\n", strerror(errno));
+        goto exit;
+    }
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons((uint16_t) opt.port);
+    if (bind(listen_fd, (struct sockaddr *) &addr, sizeof (addr)) == -1 || listen(listen_fd, 16) == -1) {
+        fprintf(stderr, "cannot listen on port %d: %s\n", opt.port, strerror(errno));
+        goto exit;
+    }
+    watch(listen_fd, LISTEN_ID, EPOLLIN, EPOLL_CTL_ADD);
+    watch(signal_fd, SIGNAL_ID, EPOLLIN, EPOLL_CTL_ADD);
+
+    uint64_t end = opt.duration > 0 ? start_time + (uint64_t) opt.duration * 1000000 : UINT64_MAX;
+    for (;;) {
+        // Sleep until the next queued packet is due.
+        uint64_t now = now_us(), next = end;
+        for (int i = 0; i < MAX_CLIENTS; ++i) {
+            if (conns[i].fd != -1 && conns[i].head && conns[i].head->due < next) {
+                next = conns[i].head->due;
+            }
+        }
+        if (now >= end) {
+            break;
+        }
+        int timeout = next == UINT64_MAX ? -1 : next <= now ? 0 : (int) ((next - now + 999) / 1000);
+        int n = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout);
+        if (n == -1 && errno != EINTR) {
+            fprintf(stderr, "epoll_wait error: %s\n", strerror(errno));
+            goto exit;
+        }
+        for (int e = 0; e < n; ++e) {
+            uint32_t id = events[e].data.u32;
+            if (id == SIGNAL_ID) {
+                goto done;
+            } else if (id == LISTEN_ID) {
+                accept_conn(listen_fd);
+            } else if ((events[e].events & (EPOLLERR | EPOLLHUP)) || ((events[e].events & EPOLLIN) && read_conn(&conns[id]) == -1)) {
+                close_conn(&conns[id]);
+            }
+        }
+        now = now_us();
+        for (int i = 0; i < MAX_CLIENTS; ++i) {
+            struct conn *c = &conns[i];
+            if (c->fd == -1) {
+                continue;
+            }
+            int full = flush_conn(c, now);
+            if (full == -1) {
+                close_conn(c);
+            } else if (full != c->blocked) {
+                c->blocked = full;
+                watch(c->fd, (uint32_t) i, full ? EPOLLIN | EPOLLOUT : EPOLLIN, EPOLL_CTL_MOD);
+            }
+        }
+    }
+done:
+    summary();
+    rc = EXIT_SUCCESS;
+
+exit:
+    for (int i = 0; i < MAX_CLIENTS; ++i) {
+        close_conn(&conns[i]);
+    }
+    if (record_file && record_file != stdout) {
+        fclose(record_file);
+    }
+    if (listen_fd != -1) {
+        close(listen_fd);
+    }
+    if (signal_fd != -1) {
+        close(signal_fd);
+    }
+    if (epoll_fd != -1) {
+        close(epoll_fd);
+    }
+    return rc;
+}
@@ -0,0 +1,102 @@
+// Part of readsbmqtt, an MQTT client that reads statistics from readsb
+// ADS-B decoder and forward them via MQTT broker into home assistant (HASS)
+//
+// bench/fmt.c: Microbenchmark of number formatting against snprintf.
+//
+// Copyright (c) 2022 Michael Wolf <michael@mictronics.de>
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <time.h>
+#include "fmt.h"
+
+#define VALUES      4096
+#define ITERATIONS  2000
+
+static uint64_t counters[VALUES];
+static double signals[VALUES];
+static volatile size_t sink;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+static double report(const char *name, double start, double ref) {
+    double ns = (now() - start) * 1e9 / ((double) VALUES * ITERATIONS);
+    if (ref > 0) {
+        printf("%-28s %8.1f ns/op  %5.1fx\n", name, ns, ref / ns);
+    } else {
+        printf("%-28s %8.1f ns/op\n", name, ns);
+    }
+    return ns;
+}
+
+int main(void) {
+    char buf[FMT_BUF_SIZE];
+    double start, ref;
+
+    // Value ranges as seen in readsb statistics
+    srand(1);
+    for (int i = 0; i < VALUES; ++i) {
+        counters[i] = (uint64_t) rand() % 2000000;
+        signals[i] = -((double) rand() / RAND_MAX) * 40.0;
+    }
+
+    start = now();
+    for (int n = 0; n < ITERATIONS; ++n) {
+        for (int i = 0; i < VALUES; ++i) {
+            sink += (size_t) snprintf(buf, sizeof (buf), "%0.1lf", (double) counters[i]);
+        }
+    }
+    ref = report("snprintf %0.1lf counter", start, 0);
+
+    start = now();
+    for (int n = 0; n < ITERATIONS; ++n) {
+        for (int i = 0; i < VALUES; ++i) {
+            sink += (size_t) snprintf(buf, sizeof (buf), "%" PRIu64, counters[i]);
+        }
+    }
+    report("snprintf %" PRIu64 " counter", start, ref);
+
+    start = now();
+    for (int n = 0; n < ITERATIONS; ++n) {
+        for (int i = 0; i < VALUES; ++i) {
+            sink += fmt_u64(buf, counters[i]);
+        }
+    }
+    report("fmt_u64 counter", start, ref);
+
+    start = now();
+    for (int n = 0; n < ITERATIONS; ++n) {
+        for (int i = 0; i < VALUES; ++i) {
+            sink += (size_t) snprintf(buf, sizeof (buf), "%0.1lf", signals[i]);
+        }
+    }
+    ref = report("snprintf %0.1lf signal", start, 0);
+
+    start = now();
+    for (int n = 0; n < ITERATIONS; ++n) {
+        for (int i = 0; i < VALUES; ++i) {
+            sink += fmt_fixed(buf, signals[i], 1);
+        }
+    }
+    report("fmt_fixed signal", start, ref);
+
+    return 0;
+}
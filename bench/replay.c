@@ -0,0 +1,511 @@
+// Part of readsbmqtt, an MQTT client that reads statistics from readsb
+// ADS-B decoder and forward them via MQTT broker into home assistant (HASS)
+//
+// bench/replay.c: End-to-end benchmark with synthetic readsb files.
+//
+// Copyright (c) 2022 Michael Wolf <michael@mictronics.de>
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/*
+ * Three parts in one program:
+ * - Generator: packs stats.pb and aircraft.pb with statistics__pack() and
+ *   aircrafts_update__pack() at the configured rates and renames them into
+ *   the watched directory, like readsb does.
+ * - Driver: starts readsbmqtt on that directory and subscribes to its
+ *   properties and aircraft_stats topics. Every frame carries a sequence
+ *   marker (messages counter of stats, now of aircraft), so arrival at the
+ *   subscriber is matched to the rename. The broker forwards a message
+ *   once it accepted it, so arrival stands for the broker ack.
+ * - Report: latency p50/p99/max per file type, frames coalesced by
+ *   readsbmqtt and CPU time of readsbmqtt per update.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <argp.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <MQTTAsync.h>
+#include "readsb.pb-c.h"
+
+#define CLIENT_ID           "bench"
+#define MESSAGES_BASE       40000   // Plausible messages per minute, sequence is added
+#define AIRCRAFT_EPOCH      1700000000
+#define POLAR_BINS          72
+#define MAX_AIRCRAFT        10000
+#define MAX_FRAMES          1000000
+#define WARMUP_TIMEOUT      10      // Seconds to wait for readsbmqtt to publish
+#define DRAIN_TIMEOUT       2       // Seconds to wait for outstanding frames after the run
+
+// Rename and arrival time of one frame, nanoseconds of CLOCK_MONOTONIC
+struct frame {
+    uint64_t renamed;
+    uint64_t arrived; // Zero when not (yet) seen, e.g. coalesced by readsbmqtt
+};
+
+// Frames of one file type
+struct series {
+    const char *name;
+    const char *marker; // JSON key of the sequence marker
+    uint64_t base; // Marker of frame 0
+    struct frame *frames;
+    unsigned count;
+};
+
+static struct {
+    const char *dir;
+    const char *exe;
+    const char *uri;
+    const char *prefix;
+    double stats_rate;
+    double aircraft_rate;
+    int aircraft;
+    int duration;
+} opt = {NULL, "./readsbmqtt", "tcp://localhost:1883", "homeassistant/sensor", 10, 1, 300, 10};
+
+static struct series stats = {"stats.pb", "\"messages\":\"", MESSAGES_BASE, NULL, 0};
+static struct series aircraft = {"aircraft.pb", "\"now\":", AIRCRAFT_EPOCH, NULL, 0};
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct argp_option options[] = {
+    {"dir", 'd', "<dir>", 0, "Directory for the generated files (default: new temp directory)", 1},
+    {"exe", 'x', "<path>", 0, "readsbmqtt to start, empty to use one already watching --dir (default: ./readsbmqtt)", 1},
+    {"broker", 'b', "<URI>", 0, "MQTT broker URI (default: tcp://localhost:1883)", 1},
+    {"topic", 't', "<topic>", 0, "MQTT topic prefix of readsbmqtt (default: homeassistant/sensor)", 1},
+    {"stats-rate", 's', "<hz>", 0, "stats.pb updates per second (default: 10)", 1},
+    {"aircraft-rate", 'A', "<hz>", 0, "aircraft.pb updates per second, 0 disables (default: 1)", 1},
+    {"aircraft", 'n', "<count>", 0, "Aircraft per aircraft.pb (default: 300)", 1},
+    {"time", 'T', "<seconds>", 0, "Duration of the measurement (default: 10)", 1},
+    { 0}
+};
+
+static error_t parse_opt(int key, char *arg, struct argp_state *state) {
+    switch (key) {
+        case 'd':
+            opt.dir = arg;
+            break;
+        case 'x':
+            opt.exe = arg;
+            break;
+        case 'b':
+            opt.uri = arg;
+            break;
+        case 't':
+            opt.prefix = arg;
+            break;
+        case 's':
+            opt.stats_rate = atof(arg);
+            break;
+        case 'A':
+            opt.aircraft_rate = atof(arg);
+            break;
+        case 'n':
+            opt.aircraft = atoi(arg);
+            if (opt.aircraft < 0 || opt.aircraft > MAX_AIRCRAFT) {
+                argp_error(state, "aircraft count must be 0..%d", MAX_AIRCRAFT);
+            }
+            break;
+        case 'T':
+            opt.duration = atoi(arg);
+            break;
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+/**
+ * Write file atomically, readsb style: temp file renamed over the target.
+ * @param renamed Set to the time right before the rename, NULL if not needed.
+ * @return Zero on success, -1 on error.
+ */
+static int write_file(const char *name, const uint8_t *data, size_t len, uint64_t *renamed) {
+    char path[4096], tmp[4096];
+    snprintf(path, sizeof (path), "%s/%s", opt.dir, name);
+    snprintf(tmp, sizeof (tmp), "%s/.%s.tmp", opt.dir, name);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1 || write(fd, data, len) != (ssize_t) len) {
+        fprintf(stderr, "cannot write %s: %s\n", tmp, strerror(errno));
+        if (fd != -1) {
+            close(fd);
+        }
+        return -1;
+    }
+    close(fd);
+    if (renamed) {
+        *renamed = now_ns();
+    }
+    return rename(tmp, path);
+}
+
+/**
+ * Remove generated files and the temp directory created for them.
+ */
+static void remove_dir(void) {
+    const char *names[] = {"stats.pb", ".stats.pb.tmp", "aircraft.pb", ".aircraft.pb.tmp"};
+    char path[4096];
+    for (size_t i = 0; i < sizeof (names) / sizeof (names[0]); ++i) {
+        snprintf(path, sizeof (path), "%s/%s", opt.dir, names[i]);
+        if (unlink(path) == -1 && errno != ENOENT) {
+            fprintf(stderr, "cannot remove %s: %s\n", path, strerror(errno));
+        }
+    }
+    if (rmdir(opt.dir) == -1) {
+        fprintf(stderr, "cannot remove %s: %s\n", opt.dir, strerror(errno));
+    }
+}
+
+/**
+ * Fill statistics entry with values in the range readsb reports.
+ */
+static void fill_entry(StatisticEntry *e, uint64_t messages, unsigned seconds, uint64_t stop) {
+    e->start = stop - seconds;
+    e->stop = stop;
+    e->messages = messages;
+    e->max_distance_in_metres = 180000 + (uint32_t) (rand() % 120000);
+    e->max_distance_in_nautical_miles = e->max_distance_in_metres / 1852;
+    e->tracks_new = 20 + (uint64_t) (rand() % 40);
+    e->tracks_single_message = (uint64_t) (rand() % 10);
+    e->tracks_with_position = e->tracks_new - (uint64_t) (rand() % 10);
+    e->tracks_mlat_position = (uint64_t) (rand() % 5);
+    e->cpu_demod = 8000 + (uint64_t) (rand() % 4000);
+    e->cpu_reader = 900 + (uint64_t) (rand() % 300);
+    e->cpu_background = 300 + (uint64_t) (rand() % 200);
+    e->cpr_airborne = messages / 4;
+    e->cpr_global_ok = e->cpr_airborne - (uint64_t) (rand() % 50);
+    e->local_samples_processed = (uint64_t) seconds * 2400000;
+    e->local_modes = messages;
+    e->local_accepted = messages;
+    e->local_strong_signals = (uint64_t) (rand() % 100);
+    e->local_signal = -15.0f - (float) (rand() % 100) / 10.0f;
+    e->local_noise = -35.0f - (float) (rand() % 50) / 10.0f;
+    e->local_peak_signal = -3.0f - (float) (rand() % 30) / 10.0f;
+}
+
+/**
+ * Generate and rename stats.pb, the last_1min messages counter carries
+ * the sequence marker.
+ * @param renamed Set to the rename time, NULL if not needed.
+ */
+static int generate_stats(unsigned seq, uint64_t *renamed) {
+    static uint8_t buf[65536];
+    StatisticEntry latest = STATISTIC_ENTRY__INIT, last_1min = STATISTIC_ENTRY__INIT;
+    StatisticEntry last_5min = STATISTIC_ENTRY__INIT, last_15min = STATISTIC_ENTRY__INIT, total = STATISTIC_ENTRY__INIT;
+    Statistics msg = STATISTICS__INIT;
+    Statistics__PolarRangeEntry polar[POLAR_BINS], *polar_ptr[POLAR_BINS];
+    uint64_t stop = AIRCRAFT_EPOCH + seq;
+
+    fill_entry(&latest, MESSAGES_BASE / 6, 10, stop);
+    fill_entry(&last_1min, MESSAGES_BASE + seq, 60, stop);
+    fill_entry(&last_5min, MESSAGES_BASE * 5, 300, stop);
+    fill_entry(&last_15min, MESSAGES_BASE * 15, 900, stop);
+    fill_entry(&total, MESSAGES_BASE * 600, 36000, stop);
+    for (int i = 0; i < POLAR_BINS; ++i) {
+        statistics__polar_range_entry__init(&polar[i]);
+        polar[i].key = (uint32_t) i * 5;
+        polar[i].value = 100000 + (uint32_t) (rand() % 200000);
+        polar_ptr[i] = &polar[i];
+    }
+    msg.latest = &latest;
+    msg.last_1min = &last_1min;
+    msg.last_5min = &last_5min;
+    msg.last_15min = &last_15min;
+    msg.total = &total;
+    msg.n_polar_range = POLAR_BINS;
+    msg.polar_range = polar_ptr;
+    if (statistics__get_packed_size(&msg) > sizeof (buf)) {
+        return -1;
+    }
+    return write_file("stats.pb", buf, statistics__pack(&msg, buf), renamed);
+}
+
+/**
+ * Generate and rename aircraft.pb, now carries the sequence marker.
+ * About a third of the aircraft get new messages per frame.
+ * @param renamed Set to the rename time, NULL if not needed.
+ */
+static int generate_aircraft(unsigned seq, uint64_t *renamed) {
+    static AircraftMeta meta[MAX_AIRCRAFT];
+    static AircraftMeta *meta_ptr[MAX_AIRCRAFT];
+    static char flights[MAX_AIRCRAFT][9];
+    static uint8_t *buf;
+    static size_t buf_size;
+    AircraftsUpdate msg = AIRCRAFTS_UPDATE__INIT;
+
+    if (seq == 0) {
+        for (int i = 0; i < opt.aircraft; ++i) {
+            AircraftMeta *a = &meta[i];
+            aircraft_meta__init(a);
+            a->addr = 0x400000 + (uint32_t) i * 7919;
+            snprintf(flights[i], sizeof (flights[i]), "BNC%04d", i);
+            a->flight = flights[i];
+            a->squawk = 01000 + (uint32_t) (rand() % 06777);
+            a->alt_baro = 1000 + rand() % 39000;
+            a->lat = 47.0 + (double) (rand() % 4000) / 1000.0;
+            a->lon = 8.0 + (double) (rand() % 6000) / 1000.0;
+            a->gs = 150 + (uint32_t) (rand() % 350);
+            a->track = rand() % 360;
+            a->rssi = -20.0f - (float) (rand() % 150) / 10.0f;
+            a->air_ground = AIRCRAFT_META__AIR_GROUND__AG_AIRBORNE;
+            meta_ptr[i] = a;
+        }
+    }
+    for (int i = 0; i < opt.aircraft; ++i) {
+        AircraftMeta *a = &meta[i];
+        if (rand() % 3 == 0) {
+            a->messages += 1 + (uint64_t) (rand() % 8);
+            a->seen = (AIRCRAFT_EPOCH + seq) * 1000;
+            a->lat += 0.001;
+            a->alt_baro += rand() % 100 - 50;
+        }
+    }
+    msg.now = AIRCRAFT_EPOCH + seq;
+    msg.messages = (uint64_t) seq * 1000;
+    msg.n_aircraft = (size_t) opt.aircraft;
+    msg.aircraft = meta_ptr;
+    size_t len = aircrafts_update__get_packed_size(&msg);
+    if (len > buf_size) {
+        free(buf);
+        buf_size = len;
+        if ((buf = malloc(buf_size)) == NULL) {
+            return -1;
+        }
+    }
+    return write_file("aircraft.pb", buf, aircrafts_update__pack(&msg, buf), renamed);
+}
+
+/**
+ * Record arrival of frame with marker found in payload.
+ */
+static void arrived(struct series *s, const char *payload, int len, uint64_t t) {
+    char text[256];
+    int n = len < (int) sizeof (text) - 1 ? len : (int) sizeof (text) - 1;
+    memcpy(text, payload, (size_t) n);
+    text[n] = '\0';
+    const char *p = strstr(text, s->marker);
+    if (p == NULL) {
+        return;
+    }
+    uint64_t seq = strtoull(p + strlen(s->marker), NULL, 10) - s->base;
+    pthread_mutex_lock(&lock);
+    if (seq < s->count && s->frames[seq].arrived == 0) {
+        s->frames[seq].arrived = t;
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+static int msg_arrived(void *context, char *topic, int topic_len, MQTTAsync_message *message) {
+    uint64_t t = now_ns();
+    size_t len = topic_len ? (size_t) topic_len : strlen(topic);
+    (void) context;
+    if (len > 11 && memcmp(topic + len - 11, "/properties", 11) == 0) {
+        arrived(&stats, message->payload, message->payloadlen, t);
+    } else {
+        arrived(&aircraft, message->payload, message->payloadlen, t);
+    }
+    MQTTAsync_freeMessage(&message);
+    MQTTAsync_free(topic);
+    return 1;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * Print latency percentiles of a series.
+ * @return Number of frames seen.
+ */
+static unsigned report(const struct series *s) {
+    uint64_t *lat = malloc((s->count + 1) * sizeof (uint64_t));
+    unsigned n = 0;
+    if (lat == NULL) {
+        return 0;
+    }
+    for (unsigned i = 0; i < s->count; ++i) {
+        // Frames that failed to be written have no rename time.
+        if (s->frames[i].arrived && s->frames[i].renamed) {
+            lat[n++] = s->frames[i].arrived - s->frames[i].renamed;
+        }
+    }
+    if (n == 0) {
+        printf("%-12s %6u frames, none published\n", s->name, s->count);
+        free(lat);
+        return 0;
+    }
+    qsort(lat, n, sizeof (uint64_t), compare_u64);
+    printf("%-12s %6u frames %6u coalesced  p50 %8.3f ms  p99 %8.3f ms  max %8.3f ms\n",
+            s->name, s->count, s->count - n, (double) lat[n / 2] / 1e6,
+            (double) lat[(size_t) ((n - 1) * 0.99)] / 1e6, (double) lat[n - 1] / 1e6);
+    free(lat);
+    return n;
+}
+
+/**
+ * Start readsbmqtt on the generated directory.
+ * @return Process id, -1 on error.
+ */
+static pid_t start_client(void) {
+    char receiver[4096];
+    snprintf(receiver, sizeof (receiver), "%s=%s", opt.dir, CLIENT_ID);
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (opt.aircraft_rate > 0) {
+            execl(opt.exe, opt.exe, "-b", opt.uri, "-t", opt.prefix, "-i", CLIENT_ID, "-r", receiver, "-a", (char *) NULL);
+        } else {
+            execl(opt.exe, opt.exe, "-b", opt.uri, "-t", opt.prefix, "-i", CLIENT_ID, "-r", receiver, (char *) NULL);
+        }
+        fprintf(stderr, "cannot start %s: %s\n", opt.exe, strerror(errno));
+        _exit(EXIT_FAILURE);
+    }
+    return pid;
+}
+
+int main(int argc, char *argv[]) {
+    struct argp argp = {options, parse_opt, "", "End-to-end benchmark of readsbmqtt with synthetic readsb files", NULL, NULL, NULL};
+    MQTTAsync_connectOptions conn = MQTTAsync_connectOptions_initializer;
+    MQTTAsync client = NULL;
+    char topic[512], tmpdir[] = "/tmp/readsbmqtt-bench-XXXXXX";
+    pid_t pid = -1;
+    int rc = EXIT_FAILURE;
+    int own_dir = 0;
+
+    if (argp_parse(&argp, argc, argv, 0, 0, 0)) {
+        return EXIT_FAILURE;
+    }
+    if (opt.dir == NULL && (opt.dir = mkdtemp(tmpdir)) == NULL) {
+        fprintf(stderr, "cannot create temp directory: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    own_dir = opt.dir == tmpdir;
+    stats.count = opt.stats_rate > 0 ? (unsigned) (opt.stats_rate * opt.duration) : 0;
+    aircraft.count = opt.aircraft_rate > 0 ? (unsigned) (opt.aircraft_rate * opt.duration) : 0;
+    if (stats.count > MAX_FRAMES || aircraft.count > MAX_FRAMES) {
+        fprintf(stderr, "too many frames, maximum is %d\n", MAX_FRAMES);
+        goto exit;
+    }
+    stats.frames = calloc(stats.count + 1, sizeof (struct frame));
+    aircraft.frames = calloc(aircraft.count + 1, sizeof (struct frame));
+    srand(1);
+
+    if (MQTTAsync_create(&client, opt.uri, "readsbmqtt-replay", MQTTCLIENT_PERSISTENCE_NONE, NULL) != MQTTASYNC_SUCCESS
+            || MQTTAsync_setCallbacks(client, NULL, NULL, msg_arrived, NULL) != MQTTASYNC_SUCCESS
+            || MQTTAsync_connect(client, &conn) != MQTTASYNC_SUCCESS) {
+        fprintf(stderr, "cannot connect to %s\n", opt.uri);
+        goto exit;
+    }
+    for (int i = 0; i < 100 && !MQTTAsync_isConnected(client); ++i) {
+        usleep(50000);
+    }
+    snprintf(topic, sizeof (topic), "%s/%s/properties", opt.prefix, CLIENT_ID);
+    MQTTAsync_subscribe(client, topic, 1, NULL);
+    snprintf(topic, sizeof (topic), "%s/%s/aircraft_stats", opt.prefix, CLIENT_ID);
+    MQTTAsync_subscribe(client, topic, 1, NULL);
+
+    // Initial files, then start the client and wait until it publishes.
+    if (generate_stats(0, NULL) == -1 || (opt.aircraft_rate > 0 && generate_aircraft(0, NULL) == -1)) {
+        goto exit;
+    }
+    if (opt.exe[0] && (pid = start_client()) == -1) {
+        goto exit;
+    }
+    uint64_t deadline = now_ns() + (uint64_t) WARMUP_TIMEOUT * 1000000000;
+    while (stats.count && now_ns() < deadline) {
+        generate_stats(0, NULL);
+        usleep(200000);
+        pthread_mutex_lock(&lock);
+        int ready = stats.frames[0].arrived != 0;
+        stats.frames[0].arrived = 0;
+        pthread_mutex_unlock(&lock);
+        if (ready) {
+            break;
+        }
+    }
+
+    // Generator: renames on a fixed schedule, frame 0 is the warm-up one.
+    uint64_t start = now_ns();
+    unsigned s = 1, a = 1;
+    while (s < stats.count || a < aircraft.count) {
+        uint64_t next_s = s < stats.count ? start + (uint64_t) (s * 1e9 / opt.stats_rate) : UINT64_MAX;
+        uint64_t next_a = a < aircraft.count ? start + (uint64_t) (a * 1e9 / opt.aircraft_rate) : UINT64_MAX;
+        uint64_t next = next_s < next_a ? next_s : next_a;
+        struct timespec ts = {.tv_sec = (time_t) (next / 1000000000), .tv_nsec = (long) (next % 1000000000)};
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        uint64_t renamed = 0;
+        if (next == next_s) {
+            generate_stats(s, &renamed);
+            pthread_mutex_lock(&lock);
+            stats.frames[s++].renamed = renamed;
+            pthread_mutex_unlock(&lock);
+        } else {
+            generate_aircraft(a, &renamed);
+            pthread_mutex_lock(&lock);
+            aircraft.frames[a++].renamed = renamed;
+            pthread_mutex_unlock(&lock);
+        }
+    }
+    sleep(DRAIN_TIMEOUT);
+
+    printf("readsbmqtt replay: %.1f stats/s, %.1f aircraft/s with %d aircraft, %d s\n",
+            opt.stats_rate, opt.aircraft_rate, opt.aircraft, opt.duration);
+    pthread_mutex_lock(&lock);
+    stats.frames[0].arrived = 0;
+    aircraft.frames[0].arrived = 0;
+    unsigned updates = report(&stats) + report(&aircraft);
+    pthread_mutex_unlock(&lock);
+
+    if (pid > 0) {
+        struct rusage ru;
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+        getrusage(RUSAGE_CHILDREN, &ru);
+        double cpu = (double) ru.ru_utime.tv_sec + (double) ru.ru_utime.tv_usec / 1e6
+                + (double) ru.ru_stime.tv_sec + (double) ru.ru_stime.tv_usec / 1e6;
+        printf("cpu          %.3f s total, %.3f ms per published update\n", cpu, updates ? cpu * 1e3 / updates : 0);
+        pid = -1;
+    }
+    rc = EXIT_SUCCESS;
+
+exit:
+    if (pid > 0) {
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+    }
+    if (client) {
+        MQTTAsync_destroy(&client);
+    }
+    free(stats.frames);
+    free(aircraft.frames);
+    if (own_dir) {
+        remove_dir();
+    }
+    return rc;
+}
@@ -0,0 +1,149 @@
+// Part of readsbmqtt, an MQTT client that reads statistics from readsb
+// ADS-B decoder and forward them via MQTT broker into home assistant (HASS)
+//
+// codec.c: Payload compression codecs with reused state.
+//
+// Copyright (c) 2022 Michael Wolf <michael@mictronics.de>
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include "codec.h"
+
+static int zlib_init(struct codec *c) {
+    z_stream *zs = calloc(1, sizeof (z_stream));
+    if (zs == NULL) {
+        return -1;
+    }
+    if (deflateInit(zs, c->level) != Z_OK) {
+        free(zs);
+        return -1;
+    }
+    c->state = zs;
+    return 0;
+}
+
+static size_t zlib_bound(struct codec *c, size_t len) {
+    return deflateBound(c->state, (uLong) len);
+}
+
+static int zlib_compress(struct codec *c, const void *in, size_t len, uint8_t *out, size_t *out_len) {
+    z_stream *zs = c->state;
+    // Reset keeps window and hash tables allocated
+    if (deflateReset(zs) != Z_OK) {
+        return -1;
+    }
+    zs->next_in = (Bytef *) in;
+    zs->avail_in = (uInt) len;
+    zs->next_out = out;
+    zs->avail_out = (uInt) *out_len;
+    if (deflate(zs, Z_FINISH) != Z_STREAM_END) {
+        return -1;
+    }
+    *out_len = zs->total_out;
+    return 0;
+}
+
+static void zlib_destroy(struct codec *c) {
+    deflateEnd(c->state);
+    free(c->state);
+}
+
+static const struct codec_ops codecs[] = {
+    {"zlib", 'z', 1, 9, 6, zlib_init, zlib_bound, zlib_compress, zlib_destroy},
+};
+
+/**
+ * Find codec by name.
+ * @param name Codec name.
+ * @return Codec or NULL when unknown.
+ */
+const struct codec_ops *codec_find(const char *name) {
+    for (size_t i = 0; i < sizeof (codecs) / sizeof (codecs[0]); ++i) {
+        if (strcmp(codecs[i].name, name) == 0) {
+            return &codecs[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Set up codec state once for all payloads.
+ * @param c Codec.
+ * @param ops Codec implementation.
+ * @param level Compression level, zero for the codec default.
+ * @return Zero on success, -1 on invalid level or allocation failure.
+ */
+int codec_init(struct codec *c, const struct codec_ops *ops, int level) {
+    memset(c, 0, sizeof (*c));
+    if (level == 0) {
+        level = ops->default_level;
+    }
+    if (level < ops->min_level || level > ops->max_level) {
+        return -1;
+    }
+    c->level = level;
+    if (ops->init(c) == -1) {
+        return -1;
+    }
+    c->ops = ops;
+    return 0;
+}
+
+/**
+ * Compress payload into the codec buffer, valid until the next call.
+ * @param c Codec.
+ * @param data Payload.
+ * @param len Payload length.
+ * @param out_len Returns length of compressed payload including marker.
+ * @return Compressed payload, or NULL when it would not be smaller than
+ * the payload or compression failed, the payload is sent plain then.
+ */
+const uint8_t *codec_compress(struct codec *c, const void *data, size_t len, size_t *out_len) {
+    size_t need = CODEC_HEADER_SIZE + c->ops->bound(c, len);
+    if (need > c->size) {
+        uint8_t *buf_new = realloc(c->buf, need);
+        if (buf_new == NULL) {
+            return NULL;
+        }
+        c->buf = buf_new;
+        c->size = need;
+    }
+    size_t n = c->size - CODEC_HEADER_SIZE;
+    if (c->ops->compress(c, data, len, c->buf + CODEC_HEADER_SIZE, &n) == -1
+            || CODEC_HEADER_SIZE + n >= len) {
+        return NULL;
+    }
+    c->buf[0] = CODEC_MARKER;
+    c->buf[1] = c->ops->id;
+    c->in_bytes += len;
+    c->out_bytes += CODEC_HEADER_SIZE + n;
+    *out_len = CODEC_HEADER_SIZE + n;
+    return c->buf;
+}
+
+/**
+ * Free codec state and buffer.
+ * @param c Codec.
+ */
+void codec_destroy(struct codec *c) {
+    if (c->ops) {
+        c->ops->destroy(c);
+    }
+    free(c->buf);
+    memset(c, 0, sizeof (*c));
+}
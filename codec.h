@@ -0,0 +1,67 @@
+// Part of readsbmqtt, an MQTT client that reads statistics from readsb
+// ADS-B decoder and forward them via MQTT broker into home assistant (HASS)
+//
+// codec.h: Payload compression codecs with reused state. (header)
+//
+// Copyright (c) 2022 Michael Wolf <michael@mictronics.de>
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A compressed payload starts with CODEC_MARKER and the codec id, followed
+ * by the compressed data. A JSON document or protobuf message never starts
+ * with a zero byte, so consumers tell compressed from plain payloads apart
+ * without a content type, which MQTT 3.1.1 does not have.
+ */
+#define CODEC_MARKER        0x00
+#define CODEC_HEADER_SIZE   2
+
+struct codec;
+
+// Codec implementation, state is set up once and reused for every payload
+struct codec_ops {
+    const char *name;
+    uint8_t id; // Second byte of the marker
+    int min_level;
+    int max_level;
+    int default_level;
+    int (*init)(struct codec *c);
+    size_t (*bound)(struct codec *c, size_t len);
+    int (*compress)(struct codec *c, const void *in, size_t len, uint8_t *out, size_t *out_len);
+    void (*destroy)(struct codec *c);
+};
+
+struct codec {
+    const struct codec_ops *ops; // NULL when not in use
+    int level;
+    void *state; // Codec private
+    uint8_t *buf; // Grow-only output buffer, header included
+    size_t size;
+    uint64_t in_bytes; // Payload bytes before and after compression
+    uint64_t out_bytes;
+};
+
+const struct codec_ops *codec_find(const char *name);
+int codec_init(struct codec *c, const struct codec_ops *ops, int level);
+const uint8_t *codec_compress(struct codec *c, const void *data, size_t len, size_t *out_len);
+void codec_destroy(struct codec *c);
+
+#endif /* CODEC_H */
@@ -0,0 +1,91 @@
+// Part of readsbmqtt, an MQTT client that reads statistics from readsb
+// ADS-B decoder and forward them via MQTT broker into home assistant (HASS)
+//
+// config.c: Line based configuration file reader.
+//
+// Copyright (c) 2022 Michael Wolf <michael@mictronics.de>
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "config.h"
+
+static int is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+/**
+ * Read configuration file and pass each setting to handler.
+ * All lines are read even after an error, so every error is reported.
+ * @param path File name.
+ * @param handler Called per setting, returns -1 on invalid setting.
+ * @param ctx Passed to handler.
+ * @return Zero on success, -1 when the file cannot be read or a setting is invalid.
+ */
+int config_parse(const char *path, config_handler handler, void *ctx) {
+    char line[CONFIG_LINE_SIZE];
+    int rc = 0, n = 0;
+    FILE *f = fopen(path, "re");
+
+    if (f == NULL) {
+        fprintf(stderr, "cannot open config %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    while (fgets(line, sizeof (line), f)) {
+        n++;
+        size_t len = strlen(line);
+        if (len == sizeof (line) - 1 && line[len - 1] != '\n' && !feof(f)) {
+            fprintf(stderr, "config %s:%d: line too long\n", path, n);
+            rc = -1;
+            int c;
+            while ((c = fgetc(f)) != EOF && c != '\n') {
+            }
+            continue;
+        }
+        while (len && is_space(line[len - 1])) {
+            line[--len] = '\0';
+        }
+        char *key = line;
+        while (is_space(*key)) {
+            key++;
+        }
+        if (*key == '\0' || *key == '#') {
+            continue;
+        }
+        char *value = key + strcspn(key, " \t=");
+        char *end = value;
+        while (is_space(*value)) {
+            value++;
+        }
+        if (*value == '=') {
+            value++;
+            while (is_space(*value)) {
+                value++;
+            }
+        }
+        *end = '\0';
+        if (handler(ctx, key, value, n) == -1) {
+            rc = -1;
+        }
+    }
+    if (ferror(f)) {
+        fprintf(stderr, "config %s read error\n", path);
+        rc = -1;
+    }
+    fclose(f);
+    return rc;
+}
@@ -0,0 +1,35 @@
+// Part of readsbmqtt, an MQTT client that reads statistics from readsb
+// ADS-B decoder and forward them via MQTT broker into home assistant (HASS)
+//
+// config.h: Line based configuration file reader. (header)
+//
+// Copyright (c) 2022 Michael Wolf <michael@mictronics.de>
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#define CONFIG_LINE_SIZE    1024
+
+/*
+ * One setting per line, "<key> <value>" or "<key> = <value>". Keys are the
+ * long option names. Empty lines and lines starting with # are skipped.
+ * The value is the rest of the line without surrounding white space.
+ */
+typedef int (*config_handler)(void *ctx, const char *key, const char *value, int line);
+
+int config_parse(const char *path, config_handler handler, void *ctx);
+
+#endif /* CONFIG_H */
@@ -0,0 +1,315 @@
+// Part of readsbmqtt, an MQTT client that reads statistics from readsb
+// ADS-B decoder and forward them via MQTT broker into home assistant (HASS)
+//
+// exporter.c: Minimal HTTP listener serving a pre-rendered OpenMetrics page.
+//
+// Copyright (c) 2022 Michael Wolf <michael@mictronics.de>
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include "exporter.h"
+
+#define EXPORTER_PAGE_SIZE  16384   // Initial page size, grows to fit
+
+static const char NOT_FOUND[] = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+static const char UNAVAILABLE[] = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+
+static time_t monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+/**
+ * Open listen socket and register it in epoll.
+ * @param ex Exporter.
+ * @param listen_addr "<port>", "<host>:<port>" or "[<ipv6>]:<port>".
+ * @param epoll_fd Epoll instance of the event loop.
+ * @param source Event source of the listen socket.
+ * @return Zero on success, -1 on error.
+ */
+int exporter_init(struct exporter *ex, const char *listen_addr, int epoll_fd, uint32_t source) {
+    struct addrinfo hints = {.ai_flags = AI_PASSIVE, .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+    struct addrinfo *res = NULL;
+    struct epoll_event ev = {.events = EPOLLIN, .data.u32 = source};
+    char host[256] = "";
+    const char *port = listen_addr;
+    const char *colon = strrchr(listen_addr, ':');
+    int one = 1, rc;
+
+    memset(ex, 0, sizeof (*ex));
+    ex->listen_fd = -1;
+    ex->epoll_fd = epoll_fd;
+    ex->source = source;
+    ex->front = -1;
+    for (int i = 0; i < EXPORTER_MAX_CONNS; ++i) {
+        ex->conn[i].fd = -1;
+    }
+    if (colon) {
+        const char *h = listen_addr;
+        size_t len = (size_t) (colon - listen_addr);
+        if (len >= 2 && h[0] == '[' && h[len - 1] == ']') {
+            h++;
+            len -= 2;
+        }
+        snprintf(host, sizeof (host), "%.*s", (int) len, h);
+        port = colon + 1;
+    }
+    if ((rc = getaddrinfo(host[0] ? host : NULL, port, &hints, &res)) != 0) {
+        fprintf(stderr, "exporter address %s error: %s\n", listen_addr, gai_strerror(rc));
+        return -1;
+    }
+    ex->listen_fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (ex->listen_fd == -1
+            || setsockopt(ex->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one)) == -1
+            || bind(ex->listen_fd, res->ai_addr, res->ai_addrlen) == -1
+            || listen(ex->listen_fd, EXPORTER_MAX_CONNS) == -1
+            || fcntl(ex->listen_fd, F_SETFL, O_NONBLOCK) == -1
+            || fcntl(ex->listen_fd, F_SETFD, FD_CLOEXEC) == -1
+            || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, ex->listen_fd, &ev) == -1) {
+        fprintf(stderr, "exporter listen on %s error: %s\n", listen_addr, strerror(errno));
+        freeaddrinfo(res);
+        return -1;
+    }
+    freeaddrinfo(res);
+    return 0;
+}
+
+static void close_conn(struct exporter *ex, struct exporter_conn *c) {
+    if (c->fd != -1) {
+        epoll_ctl(ex->epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+        close(c->fd);
+        c->fd = -1;
+    }
+    c->out = NULL;
+}
+
+/**
+ * Start rendering a new page into the back page.
+ * Clients still sending the back page from two renders ago are dropped.
+ * @param ex Exporter.
+ */
+void exporter_begin(struct exporter *ex) {
+    int back = ex->front == 0 ? 1 : 0;
+    for (int i = 0; i < EXPORTER_MAX_CONNS; ++i) {
+        if (ex->conn[i].fd != -1 && ex->conn[i].page == back) {
+            close_conn(ex, &ex->conn[i]);
+        }
+    }
+    ex->page[back].len = EXPORTER_HEADER_SIZE;
+    ex->error = 0;
+}
+
+/**
+ * Append data to page being rendered. The page grows as needed and keeps
+ * its size, so rendering does not allocate once the page fits.
+ */
+void exporter_append(struct exporter *ex, const char *data, size_t len) {
+    struct exporter_page *p = &ex->page[ex->front == 0 ? 1 : 0];
+    if (ex->error) {
+        return;
+    }
+    if (p->len + len > p->size) {
+        size_t size = p->size ? p->size : EXPORTER_PAGE_SIZE;
+        while (size < p->len + len) {
+            size *= 2;
+        }
+        char *data_new = realloc(p->data, size);
+        if (data_new == NULL) {
+            ex->error = 1;
+            return;
+        }
+        p->data = data_new;
+        p->size = size;
+    }
+    memcpy(p->data + p->len, data, len);
+    p->len += len;
+}
+
+void exporter_append_string(struct exporter *ex, const char *str) {
+    exporter_append(ex, str, strlen(str));
+}
+
+/**
+ * Append label value, escaping backslash, double quote and newline.
+ */
+void exporter_append_label(struct exporter *ex, const char *value) {
+    for (const char *p = value; *p; ++p) {
+        if (*p == '\\' || *p == '"') {
+            exporter_append(ex, "\\", 1);
+            exporter_append(ex, p, 1);
+        } else if (*p == '\n') {
+            exporter_append(ex, "\\n", 2);
+        } else {
+            exporter_append(ex, p, 1);
+        }
+    }
+}
+
+/**
+ * Finish page and serve it to new requests.
+ * @param ex Exporter.
+ * @return Zero on success, -1 when the page could not be allocated, the
+ * previous page is served on.
+ */
+int exporter_commit(struct exporter *ex) {
+    int back = ex->front == 0 ? 1 : 0;
+    struct exporter_page *p = &ex->page[back];
+    char header[EXPORTER_HEADER_SIZE + 1];
+
+    if (ex->error || p->data == NULL) {
+        return -1;
+    }
+    int n = snprintf(header, sizeof (header), "HTTP/1.1 200 OK\r\n"
+            "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+            "Content-Length: %zu\r\nConnection: close\r\n\r\n", p->len - EXPORTER_HEADER_SIZE);
+    if (n < 0 || n > EXPORTER_HEADER_SIZE) {
+        return -1;
+    }
+    memcpy(p->data + EXPORTER_HEADER_SIZE - n, header, (size_t) n);
+    p->response = p->data + EXPORTER_HEADER_SIZE - n;
+    p->response_len = p->len - EXPORTER_HEADER_SIZE + (size_t) n;
+    ex->front = back;
+    return 0;
+}
+
+/**
+ * Accept pending connections. Connections beyond EXPORTER_MAX_CONNS are closed.
+ * @param ex Exporter.
+ */
+void exporter_accept(struct exporter *ex) {
+    int fd;
+    while ((fd = accept(ex->listen_fd, NULL, NULL)) != -1) {
+        int i = 0;
+        while (i < EXPORTER_MAX_CONNS && ex->conn[i].fd != -1) {
+            i++;
+        }
+        struct epoll_event ev = {.events = EPOLLIN, .data.u32 = ex->source + 1 + (uint32_t) i};
+        if (i == EXPORTER_MAX_CONNS || fcntl(fd, F_SETFL, O_NONBLOCK) == -1
+                || fcntl(fd, F_SETFD, FD_CLOEXEC) == -1
+                || epoll_ctl(ex->epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+            close(fd);
+            continue;
+        }
+        struct exporter_conn *c = &ex->conn[i];
+        c->fd = fd;
+        c->page = -1;
+        c->out = NULL;
+        c->req_len = 0;
+        c->start = monotonic_seconds();
+    }
+}
+
+/**
+ * Send response until done or socket is full.
+ * @return Zero when sent completely, 1 when pending, -1 on error.
+ */
+static int send_response(struct exporter_conn *c) {
+    while (c->left) {
+        ssize_t n = send(c->fd, c->out, c->left, MSG_NOSIGNAL);
+        if (n == -1) {
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 1 : -1;
+        }
+        c->out += n;
+        c->left -= (size_t) n;
+    }
+    return 0;
+}
+
+/**
+ * Handle readiness of a client connection: read the request, then send
+ * the front page or a static reply.
+ * @param ex Exporter.
+ * @param index Connection index, event source minus source minus one.
+ */
+void exporter_handle(struct exporter *ex, int index) {
+    struct exporter_conn *c;
+    int rc;
+
+    if (index < 0 || index >= EXPORTER_MAX_CONNS || ex->conn[index].fd == -1) {
+        return;
+    }
+    c = &ex->conn[index];
+    if (c->page == -1 && c->out == NULL) {
+        ssize_t n = read(c->fd, c->req + c->req_len, sizeof (c->req) - 1 - c->req_len);
+        if (n <= 0) {
+            if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                close_conn(ex, c);
+            }
+            return;
+        }
+        c->req_len += (size_t) n;
+        c->req[c->req_len] = '\0';
+        if (strstr(c->req, "\r\n\r\n") == NULL && c->req_len < sizeof (c->req) - 1) {
+            return; // Request header incomplete
+        }
+        if (strncmp(c->req, "GET /metrics ", 13) != 0 && strncmp(c->req, "GET /metrics?", 13) != 0) {
+            c->out = NOT_FOUND;
+            c->left = sizeof (NOT_FOUND) - 1;
+        } else if (ex->front == -1) {
+            c->out = UNAVAILABLE;
+            c->left = sizeof (UNAVAILABLE) - 1;
+        } else {
+            c->page = ex->front;
+            c->out = ex->page[c->page].response;
+            c->left = ex->page[c->page].response_len;
+        }
+    }
+    rc = send_response(c);
+    if (rc == 1) {
+        struct epoll_event ev = {.events = EPOLLOUT, .data.u32 = ex->source + 1 + (uint32_t) index};
+        epoll_ctl(ex->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+        return;
+    }
+    close_conn(ex, c);
+}
+
+/**
+ * Drop clients that took longer than EXPORTER_TIMEOUT.
+ * @param ex Exporter.
+ */
+void exporter_expire(struct exporter *ex) {
+    time_t now = monotonic_seconds();
+    for (int i = 0; i < EXPORTER_MAX_CONNS; ++i) {
+        if (ex->conn[i].fd != -1 && now - ex->conn[i].start > EXPORTER_TIMEOUT) {
+            close_conn(ex, &ex->conn[i]);
+        }
+    }
+}
+
+/**
+ * Close all sockets and free pages.
+ * @param ex Exporter.
+ */
+void exporter_destroy(struct exporter *ex) {
+    for (int i = 0; i < EXPORTER_MAX_CONNS; ++i) {
+        close_conn(ex, &ex->conn[i]);
+    }
+    if (ex->listen_fd != -1) {
+        close(ex->listen_fd);
+        ex->listen_fd = -1;
+    }
+    free(ex->page[0].data);
+    free(ex->page[1].data);
+    memset(ex->page, 0, sizeof (ex->page));
+}
@@ -0,0 +1,81 @@
+// Part of readsbmqtt, an MQTT client that reads statistics from readsb
+// ADS-B decoder and forward them via MQTT broker into home assistant (HASS)
+//
+// exporter.h: Minimal HTTP listener serving a pre-rendered OpenMetrics page. (header)
+//
+// Copyright (c) 2022 Michael Wolf <michael@mictronics.de>
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef EXPORTER_H
+#define EXPORTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#define EXPORTER_MAX_CONNS      8
+#define EXPORTER_REQUEST_SIZE   1024
+#define EXPORTER_HEADER_SIZE    160 // Reserved in front of the body for the HTTP header
+#define EXPORTER_TIMEOUT        5   // Seconds a client may take for request and response
+
+// Response page, header is written right in front of the body
+struct exporter_page {
+    char *data;
+    size_t size;
+    size_t len; // Length of data including reserved header space
+    const char *response; // Start of header, NULL before first commit
+    size_t response_len;
+};
+
+struct exporter_conn {
+    int fd; // -1 when free
+    int page; // Page being sent, -1 while reading the request
+    const char *out;
+    size_t left;
+    time_t start;
+    size_t req_len;
+    char req[EXPORTER_REQUEST_SIZE];
+};
+
+/*
+ * Serves GET /metrics from the page rendered last, other paths get 404.
+ * Pages are double-buffered: a new page is rendered into the back page
+ * while clients are still sent the front page. Rendering happens only
+ * when new data arrived, a scrape just writes the ready response.
+ * All sockets are non-blocking and registered in the caller's epoll
+ * instance, the listen socket as source, connections as source + 1 + n.
+ */
+struct exporter {
+    int listen_fd;
+    int epoll_fd;
+    uint32_t source;
+    int front; // Page served to new requests, -1 before first commit
+    int error; // Page buffer allocation failed while rendering
+    struct exporter_page page[2];
+    struct exporter_conn conn[EXPORTER_MAX_CONNS];
+};
+
+int exporter_init(struct exporter *ex, const char *listen_addr, int epoll_fd, uint32_t source);
+void exporter_begin(struct exporter *ex);
+void exporter_append(struct exporter *ex, const char *data, size_t len);
+void exporter_append_string(struct exporter *ex, const char *str);
+void exporter_append_label(struct exporter *ex, const char *value);
+int exporter_commit(struct exporter *ex);
+void exporter_accept(struct exporter *ex);
+void exporter_handle(struct exporter *ex, int index);
+void exporter_expire(struct exporter *ex);
+void exporter_destroy(struct exporter *ex);
+
+#endif /* EXPORTER_H */
@@ -0,0 +1,126 @@
+// Part of readsbmqtt, an MQTT client that reads statistics from readsb
+// ADS-B decoder and forward them via MQTT broker into home assistant (HASS)
+//
+// fmt.c: Number formatting for MQTT payloads.
+//
+// Locale independent replacement for snprintf "%d" and "%.Nf" formats.
+//
+// Copyright (c) 2022 Michael Wolf <michael@mictronics.de>
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <string.h>
+#include "fmt.h"
+
+static const char DIGITS2[] =
+        "00010203040506070809"
+        "10111213141516171819"
+        "20212223242526272829"
+        "30313233343536373839"
+        "40414243444546474849"
+        "50515253545556575859"
+        "60616263646566676869"
+        "70717273747576777879"
+        "80818283848586878889"
+        "90919293949596979899";
+
+static const uint64_t POW10[FMT_MAX_DECIMALS + 1] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
+
+/**
+ * Format unsigned integer, two digits per division.
+ * @param buf Output buffer, at least FMT_BUF_SIZE bytes.
+ * @param value Value.
+ * @return Number of characters written, without NUL termination.
+ */
+size_t fmt_u64(char *buf, uint64_t value) {
+    char tmp[20];
+    char *p = tmp + sizeof (tmp);
+
+    while (value >= 100) {
+        unsigned i = (unsigned) (value % 100) * 2;
+        value /= 100;
+        *--p = DIGITS2[i + 1];
+        *--p = DIGITS2[i];
+    }
+    if (value >= 10) {
+        unsigned i = (unsigned) value * 2;
+        *--p = DIGITS2[i + 1];
+        *--p = DIGITS2[i];
+    } else {
+        *--p = (char) ('0' + value);
+    }
+
+    size_t len = (size_t) (tmp + sizeof (tmp) - p);
+    memcpy(buf, p, len);
+    buf[len] = '\0';
+    return len;
+}
+
+/**
+ * Format signed integer.
+ * @param buf Output buffer, at least FMT_BUF_SIZE bytes.
+ * @param value Value.
+ * @return Number of characters written, without NUL termination.
+ */
+size_t fmt_i64(char *buf, int64_t value) {
+    if (value < 0) {
+        buf[0] = '-';
+        return 1 + fmt_u64(buf + 1, (uint64_t) 0 - (uint64_t) value);
+    }
+    return fmt_u64(buf, (uint64_t) value);
+}
+
+/**
+ * Format real number with fixed number of decimals, rounded half away from zero.
+ * @param buf Output buffer, at least FMT_BUF_SIZE bytes.
+ * @param value Value.
+ * @param decimals Number of decimals, 0 to FMT_MAX_DECIMALS.
+ * @return Number of characters written, without NUL termination.
+ */
+size_t fmt_fixed(char *buf, double value, int decimals) {
+    char *p = buf;
+
+    if (decimals < 0) {
+        decimals = 0;
+    } else if (decimals > FMT_MAX_DECIMALS) {
+        decimals = FMT_MAX_DECIMALS;
+    }
+
+    double scaled = value < 0 ? -value * (double) POW10[decimals] : value * (double) POW10[decimals];
+    // NaN, infinity and values beyond integer range are rare, leave them to libc.
+    if (!(scaled < 1e18)) {
+        int len = snprintf(buf, FMT_BUF_SIZE, "%.*f", decimals, value);
+        return len < FMT_BUF_SIZE ? (size_t) len : FMT_BUF_SIZE - 1;
+    }
+
+    if (value < 0) {
+        *p++ = '-';
+    }
+    uint64_t n = (uint64_t) (scaled + 0.5);
+    p += fmt_u64(p, n / POW10[decimals]);
+    if (decimals) {
+        uint64_t frac = n % POW10[decimals];
+        *p++ = '.';
+        for (int d = decimals - 1; d >= 0; --d) {
+            p[d] = (char) ('0' + frac % 10);
+            frac /= 10;
+        }
+        p += decimals;
+        *p = '\0';
+    }
+    return (size_t) (p - buf);
+}
@@ -0,0 +1,35 @@
+// Part of readsbmqtt, an MQTT client that reads statistics from readsb
+// ADS-B decoder and forward them via MQTT broker into home assistant (HASS)
+//
+// fmt.h: Number formatting for MQTT payloads. (header)
+//
+// Copyright (c) 2022 Michael Wolf <michael@mictronics.de>
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef FMT_H
+#define FMT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Output buffer size that fits any formatted number and NUL termination
+#define FMT_BUF_SIZE    32
+#define FMT_MAX_DECIMALS 9
+
+size_t fmt_u64(char *buf, uint64_t value);
+size_t fmt_i64(char *buf, int64_t value);
+size_t fmt_fixed(char *buf, double value, int decimals);
+
+#endif /* FMT_H */
@@ -0,0 +1,246 @@
+// Part of readsbmqtt, an MQTT client that reads statistics from readsb
+// ADS-B decoder and forward them via MQTT broker into home assistant (HASS)
+//
+// json.c: Minimal JSON writer for MQTT payloads.
+//
+// Copyright (c) 2022 Michael Wolf <michael@mictronics.de>
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <string.h>
+#include "json.h"
+
+/**
+ * Append bytes to output.
+ * @param json Writer.
+ * @param s Bytes to append.
+ * @param n Number of bytes.
+ */
+static void put(struct json *json, const char *s, size_t n) {
+    // Keep one byte for NUL termination.
+    if (json->error || n >= json->size - json->len) {
+        json->error = 1;
+        return;
+    }
+    memcpy(json->buf + json->len, s, n);
+    json->len += n;
+}
+
+/**
+ * Append single character to output.
+ * @param json Writer.
+ * @param c Character.
+ */
+static void put_char(struct json *json, char c) {
+    if (json->error || json->len + 1 >= json->size) {
+        json->error = 1;
+        return;
+    }
+    json->buf[json->len++] = c;
+}
+
+/**
+ * Write separator if required before next key or value.
+ * @param json Writer.
+ */
+static void separate(struct json *json) {
+    if (json->comma) {
+        put_char(json, ',');
+    }
+}
+
+/**
+ * Append string with JSON escaping, without quotes.
+ * @param json Writer.
+ * @param s NUL terminated string.
+ */
+static void put_escaped(struct json *json, const char *s) {
+    static const char hex[] = "0123456789abcdef";
+    const char *run = s;
+
+    for (; *s; ++s) {
+        unsigned char c = (unsigned char) *s;
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        // Flush unescaped run, then the escape sequence.
+        put(json, run, (size_t) (s - run));
+        run = s + 1;
+        switch (c) {
+            case '"': put(json, "\\\"", 2);
+                break;
+            case '\\': put(json, "\\\\", 2);
+                break;
+            case '\n': put(json, "\\n", 2);
+                break;
+            case '\r': put(json, "\\r", 2);
+                break;
+            case '\t': put(json, "\\t", 2);
+                break;
+            default:
+            {
+                char u[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf]};
+                put(json, u, sizeof (u));
+                break;
+            }
+        }
+    }
+    put(json, run, (size_t) (s - run));
+}
+
+/**
+ * Initialize writer.
+ * @param json Writer.
+ * @param buf Output buffer.
+ * @param size Output buffer size.
+ */
+void json_init(struct json *json, char *buf, size_t size) {
+    json->buf = buf;
+    json->size = size;
+    json->len = 0;
+    json->comma = 0;
+    json->error = size == 0;
+    if (size) {
+        buf[0] = '\0';
+    }
+}
+
+/**
+ * Terminate output.
+ * @param json Writer.
+ * @param len Returns output length, without NUL termination.
+ * @return Zero on success, -1 when output was truncated.
+ */
+int json_finish(struct json *json, size_t *len) {
+    if (json->size) {
+        json->buf[json->len] = '\0';
+    }
+    if (len) {
+        *len = json->len;
+    }
+    return json->error ? -1 : 0;
+}
+
+void json_object_begin(struct json *json) {
+    separate(json);
+    put_char(json, '{');
+    json->comma = 0;
+}
+
+void json_object_end(struct json *json) {
+    put_char(json, '}');
+    json->comma = 1;
+}
+
+void json_array_begin(struct json *json) {
+    separate(json);
+    put_char(json, '[');
+    json->comma = 0;
+}
+
+void json_array_end(struct json *json) {
+    put_char(json, ']');
+    json->comma = 1;
+}
+
+/**
+ * Write object key, next call writes its value.
+ * @param json Writer.
+ * @param key Key name.
+ */
+void json_key(struct json *json, const char *key) {
+    separate(json);
+    put_char(json, '"');
+    put_escaped(json, key);
+    put(json, "\":", 2);
+    json->comma = 0;
+}
+
+/**
+ * Write key that was formatted by json_key() before, e.g. at startup.
+ * @param json Writer.
+ * @param key Quoted and escaped key including colon.
+ * @param len Key length.
+ */
+void json_key_raw(struct json *json, const char *key, size_t len) {
+    separate(json);
+    put(json, key, len);
+    json->comma = 0;
+}
+
+/**
+ * Write escaped string value.
+ * @param json Writer.
+ * @param value NUL terminated string.
+ */
+void json_string(struct json *json, const char *value) {
+    json_string_begin(json);
+    json_string_append(json, value);
+    json_string_end(json);
+}
+
+/**
+ * Start string value that is assembled from several parts.
+ * @param json Writer.
+ */
+void json_string_begin(struct json *json) {
+    separate(json);
+    put_char(json, '"');
+    json->comma = 0;
+}
+
+void json_string_append(struct json *json, const char *value) {
+    put_escaped(json, value);
+}
+
+void json_string_end(struct json *json) {
+    put_char(json, '"');
+    json->comma = 1;
+}
+
+/**
+ * Write string value that needs no escaping, e.g. a formatted number.
+ * @param json Writer.
+ * @param value Value.
+ * @param len Value length.
+ */
+void json_string_raw(struct json *json, const char *value, size_t len) {
+    separate(json);
+    put_char(json, '"');
+    put(json, value, len);
+    put_char(json, '"');
+    json->comma = 1;
+}
+
+/**
+ * Write value that is already valid JSON, e.g. a number.
+ * @param json Writer.
+ * @param value Value.
+ * @param len Value length.
+ */
+void json_raw(struct json *json, const char *value, size_t len) {
+    separate(json);
+    put(json, value, len);
+    json->comma = 1;
+}
+
+void json_member_string(struct json *json, const char *key, const char *value) {
+    json_key(json, key);
+    json_string(json, value);
+}
+
+void json_member_raw(struct json *json, const char *key, const char *value, size_t len) {
+    json_key(json, key);
+    json_raw(json, value, len);
+}
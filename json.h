@@ -0,0 +1,56 @@
+// Part of readsbmqtt, an MQTT client that reads statistics from readsb
+// ADS-B decoder and forward them via MQTT broker into home assistant (HASS)
+//
+// json.h: Minimal JSON writer for MQTT payloads. (header)
+//
+// Copyright (c) 2022 Michael Wolf <michael@mictronics.de>
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef JSON_H
+#define JSON_H
+
+#include <stddef.h>
+
+/*
+ * Writes JSON into a caller provided buffer in one pass. Separators are
+ * inserted automatically. On overflow the writer stops and the error is
+ * reported by json_finish(), output is always NUL terminated.
+ */
+struct json {
+    char *buf;
+    size_t size;
+    size_t len;
+    int comma; // Next key or value needs a separator
+    int error; // Buffer overflow
+};
+
+void json_init(struct json *json, char *buf, size_t size);
+int json_finish(struct json *json, size_t *len);
+void json_object_begin(struct json *json);
+void json_object_end(struct json *json);
+void json_array_begin(struct json *json);
+void json_array_end(struct json *json);
+void json_key(struct json *json, const char *key);
+void json_key_raw(struct json *json, const char *key, size_t len);
+void json_string(struct json *json, const char *value);
+void json_string_begin(struct json *json);
+void json_string_append(struct json *json, const char *value);
+void json_string_end(struct json *json);
+void json_string_raw(struct json *json, const char *value, size_t len);
+void json_raw(struct json *json, const char *value, size_t len);
+void json_member_string(struct json *json, const char *key, const char *value);
+void json_member_raw(struct json *json, const char *key, const char *value, size_t len);
+
+#endif /* JSON_H */
@@ -0,0 +1,53 @@
+// Part of readsbmqtt, an MQTT client that reads statistics from readsb
+// ADS-B decoder and forward them via MQTT broker into home assistant (HASS)
+//
+// mailbox.c: Latest-wins notification slot per input file.
+//
+// Copyright (c) 2022 Michael Wolf <michael@mictronics.de>
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "mailbox.h"
+
+/**
+ * Post notification, replacing one not taken yet.
+ * @param mb Mailbox.
+ * @param value Non-zero value, e.g. time the file was seen.
+ * @return 1 when a pending notification was replaced, 0 otherwise.
+ */
+int mailbox_post(struct mailbox *mb, uint64_t value) {
+    atomic_fetch_add_explicit(&mb->posted, 1, memory_order_relaxed);
+    if (atomic_exchange(&mb->value, value) != 0) {
+        atomic_fetch_add_explicit(&mb->coalesced, 1, memory_order_relaxed);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Take latest notification.
+ * @param mb Mailbox.
+ * @return Posted value, zero when empty.
+ */
+uint64_t mailbox_take(struct mailbox *mb) {
+    return atomic_exchange(&mb->value, 0);
+}
+
+/**
+ * @return Non zero when a notification is waiting.
+ */
+int mailbox_pending(struct mailbox *mb) {
+    return atomic_load(&mb->value) != 0;
+}
@@ -0,0 +1,44 @@
+// Part of readsbmqtt, an MQTT client that reads statistics from readsb
+// ADS-B decoder and forward them via MQTT broker into home assistant (HASS)
+//
+// mailbox.h: Latest-wins notification slot per input file. (header)
+//
+// Copyright (c) 2022 Michael Wolf <michael@mictronics.de>
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef MAILBOX_H
+#define MAILBOX_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+/*
+ * Holds the latest notification about one input file, the time its new
+ * version was seen. A post that replaces one not taken yet is counted as
+ * coalesced, that version of the file is neither read nor decoded.
+ * Lock-free for one producer and one consumer thread.
+ */
+struct mailbox {
+    atomic_uint_fast64_t value; // Zero when empty
+    atomic_uint_fast64_t posted;
+    atomic_uint_fast64_t coalesced;
+};
+
+int mailbox_post(struct mailbox *mb, uint64_t value);
+uint64_t mailbox_take(struct mailbox *mb);
+int mailbox_pending(struct mailbox *mb);
+
+#endif /* MAILBOX_H */
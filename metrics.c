@@ -0,0 +1,99 @@
+// Part of readsbmqtt, an MQTT client that reads statistics from readsb
+// ADS-B decoder and forward them via MQTT broker into home assistant (HASS)
+//
+// metrics.c: Fixed-bucket histograms for self-instrumentation.
+//
+// Copyright (c) 2022 Michael Wolf <michael@mictronics.de>
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "metrics.h"
+#include "fmt.h"
+
+/**
+ * Add duration to histogram.
+ * @param h Histogram.
+ * @param us Duration in microseconds.
+ */
+void histogram_add(struct histogram *h, uint64_t us) {
+    int i = 0;
+    while (i < HISTOGRAM_BUCKETS - 1 && us > histogram_bound(i)) {
+        i++;
+    }
+    atomic_fetch_add_explicit(&h->bucket[i], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->sum, us, memory_order_relaxed);
+    uint64_t max = atomic_load_explicit(&h->max, memory_order_relaxed);
+    while (us > max && !atomic_compare_exchange_weak_explicit(&h->max, &max, us,
+            memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+/**
+ * Upper bound of bucket.
+ * @param bucket Bucket index.
+ * @return Bound in microseconds, UINT64_MAX for the overflow bucket.
+ */
+uint64_t histogram_bound(int bucket) {
+    return bucket < HISTOGRAM_BUCKETS - 1 ? (uint64_t) HISTOGRAM_MIN_US << bucket : UINT64_MAX;
+}
+
+/**
+ * Estimate quantile as upper bound of the bucket it falls in.
+ * @param h Histogram.
+ * @param q Quantile 0..1.
+ * @return Bound in microseconds, maximum seen for the overflow bucket, 0 when empty.
+ */
+uint64_t histogram_quantile(const struct histogram *h, double q) {
+    uint64_t count = atomic_load_explicit(&h->count, memory_order_relaxed);
+    uint64_t rank = (uint64_t) (q * (double) count + 0.5), seen = 0;
+
+    if (count == 0) {
+        return 0;
+    }
+    if (rank == 0) {
+        rank = 1;
+    }
+    for (int i = 0; i < HISTOGRAM_BUCKETS - 1; ++i) {
+        seen += atomic_load_explicit(&h->bucket[i], memory_order_relaxed);
+        if (seen >= rank) {
+            return histogram_bound(i);
+        }
+    }
+    return atomic_load_explicit(&h->max, memory_order_relaxed);
+}
+
+/**
+ * Write histogram object, bucket counts are not cumulative.
+ * {"count":n,"sum_us":n,"max_us":n,"p50_us":n,"p99_us":n,"buckets":[...]}
+ * @param json Writer.
+ * @param h Histogram.
+ */
+void histogram_json(struct json *json, const struct histogram *h) {
+    char buf[FMT_BUF_SIZE];
+
+    json_object_begin(json);
+    json_member_raw(json, "count", buf, fmt_u64(buf, atomic_load_explicit(&h->count, memory_order_relaxed)));
+    json_member_raw(json, "sum_us", buf, fmt_u64(buf, atomic_load_explicit(&h->sum, memory_order_relaxed)));
+    json_member_raw(json, "max_us", buf, fmt_u64(buf, atomic_load_explicit(&h->max, memory_order_relaxed)));
+    json_member_raw(json, "p50_us", buf, fmt_u64(buf, histogram_quantile(h, 0.5)));
+    json_member_raw(json, "p99_us", buf, fmt_u64(buf, histogram_quantile(h, 0.99)));
+    json_key(json, "buckets");
+    json_array_begin(json);
+    for (int i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+        json_raw(json, buf, fmt_u64(buf, atomic_load_explicit(&h->bucket[i], memory_order_relaxed)));
+    }
+    json_array_end(json);
+    json_object_end(json);
+}
@@ -0,0 +1,48 @@
+// Part of readsbmqtt, an MQTT client that reads statistics from readsb
+// ADS-B decoder and forward them via MQTT broker into home assistant (HASS)
+//
+// metrics.h: Fixed-bucket histograms for self-instrumentation. (header)
+//
+// Copyright (c) 2022 Michael Wolf <michael@mictronics.de>
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include "json.h"
+
+#define HISTOGRAM_BUCKETS   20  // Last bucket takes all values above the others
+#define HISTOGRAM_MIN_US    16  // Upper bound of first bucket, doubles per bucket
+
+/*
+ * Durations in microseconds. Bucket i counts values up to
+ * HISTOGRAM_MIN_US << i, so 16 us to about 4.2 s plus overflow.
+ * Counters are atomic, values may be added from the MQTT client thread.
+ */
+struct histogram {
+    atomic_uint_fast64_t bucket[HISTOGRAM_BUCKETS];
+    atomic_uint_fast64_t count;
+    atomic_uint_fast64_t sum;
+    atomic_uint_fast64_t max;
+};
+
+void histogram_add(struct histogram *h, uint64_t us);
+uint64_t histogram_bound(int bucket);
+uint64_t histogram_quantile(const struct histogram *h, double q);
+void histogram_json(struct json *json, const struct histogram *h);
+
+#endif /* METRICS_H */
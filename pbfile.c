@@ -0,0 +1,246 @@
+// Part of readsbmqtt, an MQTT client that reads statistics from readsb
+// ADS-B decoder and forward them via MQTT broker into home assistant (HASS)
+//
+// pbfile.c: Reader for readsb protocol buffer files.
+//
+// Copyright (c) 2022 Michael Wolf <michael@mictronics.de>
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "pbfile.h"
+
+/**
+ * Read whole file into grow-only buffer.
+ * @param file Reader.
+ * @param fd Open file.
+ * @param size File size.
+ * @return Number of bytes read, or -1 on error.
+ */
+static ssize_t read_all(struct pbfile *file, int fd, size_t size) {
+    if (size > file->buf_size) {
+        uint8_t *buf = realloc(file->buf, size);
+        if (buf == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+        file->buf = buf;
+        file->buf_size = size;
+    }
+
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = read(fd, file->buf + done, size - done);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (n == 0) {
+            break; // Shorter than expected, use what we got.
+        }
+        done += (size_t) n;
+    }
+    return (ssize_t) done;
+}
+
+/**
+ * Get content of a protocol buffer file without copying.
+ * The content stays valid until pbfile_release() or the next read.
+ * @param file Reader.
+ * @param path Absolute path and file name.
+ * @param len Returns content length.
+ * @return Pointer to file content or NULL on error or empty file.
+ */
+const uint8_t *pbfile_read(struct pbfile *file, const char *path, size_t *len) {
+    struct stat st;
+    const uint8_t *data = NULL;
+
+    pbfile_release(file);
+    *len = 0;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        fprintf(stderr, "cannot open file %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    if (fstat(fd, &st) == -1) {
+        fprintf(stderr, "cannot determine size of %s: %s\n", path, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    size_t size = (size_t) st.st_size;
+    if (size == 0) {
+        fprintf(stderr, "file %s is empty\n", path);
+    } else if (size >= PBFILE_MMAP_MIN) {
+        void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, size, MADV_SEQUENTIAL);
+            file->map = map;
+            file->map_len = size;
+            data = map;
+            *len = size;
+        }
+    }
+
+    // Small file, or mapping not possible.
+    if (size > 0 && data == NULL) {
+        ssize_t n = read_all(file, fd, size);
+        if (n > 0) {
+            data = file->buf;
+            *len = (size_t) n;
+        } else if (n == -1) {
+            fprintf(stderr, "cannot read file %s: %s\n", path, strerror(errno));
+        }
+    }
+
+    close(fd);
+    return data;
+}
+
+/**
+ * Release content returned by pbfile_read().
+ * @param file Reader.
+ */
+void pbfile_release(struct pbfile *file) {
+    if (file->map) {
+        munmap(file->map, file->map_len);
+        file->map = NULL;
+        file->map_len = 0;
+    }
+}
+
+/**
+ * Free all reader resources.
+ * @param file Reader.
+ */
+void pbfile_destroy(struct pbfile *file) {
+    pbfile_release(file);
+    free(file->buf);
+    file->buf = NULL;
+    file->buf_size = 0;
+}
+
+/**
+ * Decode base 128 varint.
+ * @param p Position, advanced past the varint.
+ * @param end End of data.
+ * @param val Returns value.
+ * @return Zero on success, -1 on truncated or overlong varint.
+ */
+static int read_varint(const uint8_t **p, const uint8_t *end, uint64_t *val) {
+    uint64_t v = 0;
+    for (unsigned shift = 0; shift < 64 && *p < end; shift += 7) {
+        uint8_t b = *(*p)++;
+        v |= (uint64_t) (b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            *val = v;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Read next field of a message.
+ * @param p Position, advanced past the field.
+ * @param end End of message.
+ * @param item Returns field, varint holds the value of varint and fixed
+ * fields, field the content of length-delimited fields.
+ * @return 1 when a field was read, 0 at end of message, -1 on malformed message.
+ */
+int pbfile_next(const uint8_t **p, const uint8_t *end, struct pbfile_item *item) {
+    uint64_t tag;
+
+    if (*p >= end) {
+        return 0;
+    }
+    if (read_varint(p, end, &tag) == -1) {
+        return -1;
+    }
+    item->number = (uint32_t) (tag >> 3);
+    item->wire_type = (unsigned) (tag & 7);
+    item->varint = 0;
+    item->field.data = NULL;
+    item->field.len = 0;
+    switch (item->wire_type) {
+        case 0: // Varint
+            return read_varint(p, end, &item->varint) == -1 ? -1 : 1;
+        case 1: // 64 bit
+            if (end - *p < 8) {
+                return -1;
+            }
+            memcpy(&item->varint, *p, 8);
+            *p += 8;
+            return 1;
+        case 2: // Length-delimited
+        {
+            uint64_t len;
+            if (read_varint(p, end, &len) == -1 || len > (uint64_t) (end - *p)) {
+                return -1;
+            }
+            item->field.data = *p;
+            item->field.len = (size_t) len;
+            *p += len;
+            return 1;
+        }
+        case 5: // 32 bit
+        {
+            uint32_t v;
+            if (end - *p < 4) {
+                return -1;
+            }
+            memcpy(&v, *p, 4);
+            item->varint = v;
+            *p += 4;
+            return 1;
+        }
+        default: // Groups are not used by readsb
+            return -1;
+    }
+}
+
+/**
+ * Locate length-delimited top level fields of a message without decoding.
+ * Embedded messages found here can be unpacked one by one, so unused ones
+ * cost only the skip. Last occurrence of a field wins.
+ * @param data Message.
+ * @param len Message length.
+ * @param fields Field table indexed by field number, max_field + 1 entries.
+ * @param max_field Highest field number to record.
+ * @return Zero on success, -1 on malformed message.
+ */
+int pbfile_scan(const uint8_t *data, size_t len, struct pbfile_field *fields, unsigned max_field) {
+    const uint8_t *p = data;
+    struct pbfile_item item;
+    int rc;
+
+    memset(fields, 0, (max_field + 1) * sizeof (struct pbfile_field));
+    while ((rc = pbfile_next(&p, data + len, &item)) == 1) {
+        if (item.wire_type == 2 && item.number <= max_field) {
+            fields[item.number] = item.field;
+        }
+    }
+    return rc;
+}
@@ -0,0 +1,63 @@
+// Part of readsbmqtt, an MQTT client that reads statistics from readsb
+// ADS-B decoder and forward them via MQTT broker into home assistant (HASS)
+//
+// pbfile.h: Reader for readsb protocol buffer files. (header)
+//
+// Copyright (c) 2022 Michael Wolf <michael@mictronics.de>
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef PBFILE_H
+#define PBFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Files of this size and above are memory mapped, smaller ones are read.
+#define PBFILE_MMAP_MIN (64 * 1024)
+
+/*
+ * Readsb writes a temporary file and renames it over the previous one.
+ * The file is opened once after the rename and the descriptor is used
+ * for size and content, so a following rename cannot mix two files.
+ * A mapping keeps the renamed-over inode alive until released.
+ */
+struct pbfile {
+    uint8_t *buf; // Grow-only read buffer, reused for small files
+    size_t buf_size;
+    void *map; // Current mapping, if any
+    size_t map_len;
+};
+
+// Length-delimited field found by pbfile_scan(), data is NULL when absent
+struct pbfile_field {
+    const uint8_t *data;
+    size_t len;
+};
+
+// Field read by pbfile_next()
+struct pbfile_item {
+    uint32_t number;
+    unsigned wire_type;
+    uint64_t varint; // Value of varint, 64 and 32 bit fields
+    struct pbfile_field field; // Content of length-delimited fields
+};
+
+const uint8_t *pbfile_read(struct pbfile *file, const char *path, size_t *len);
+void pbfile_release(struct pbfile *file);
+void pbfile_destroy(struct pbfile *file);
+int pbfile_next(const uint8_t **p, const uint8_t *end, struct pbfile_item *item);
+int pbfile_scan(const uint8_t *data, size_t len, struct pbfile_field *fields, unsigned max_field);
+
+#endif /* PBFILE_H */
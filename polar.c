@@ -0,0 +1,219 @@
+// Part of readsbmqtt, an MQTT client that reads statistics from readsb
+// ADS-B decoder and forward them via MQTT broker into home assistant (HASS)
+//
+// polar.c: Polar range (coverage) map from readsb statistics.
+//
+// Copyright (c) 2022 Michael Wolf <michael@mictronics.de>
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "polar.h"
+#include "pbfile.h"
+#include "fmt.h"
+
+#define POLAR_PATH_SIZE 4096
+
+/**
+ * Decode polar range map field of a statistics message from the wire.
+ * Map entries are read directly, bearings are binned at POLAR_RESOLUTION
+ * keeping the maximum range.
+ * @param map Returns map, cleared first.
+ * @param data Statistics message.
+ * @param len Message length.
+ * @param field Field number of the map.
+ * @return Zero on success, -1 on malformed message.
+ */
+int polar_decode(struct polar_map *map, const uint8_t *data, size_t len, uint32_t field) {
+    const uint8_t *p = data;
+    struct pbfile_item item;
+    int rc;
+
+    memset(map, 0, sizeof (*map));
+    while ((rc = pbfile_next(&p, data + len, &item)) == 1) {
+        if (item.number != field || item.wire_type != 2) {
+            continue;
+        }
+        // Map entry: key = 1 bearing in degree, value = 2 range
+        const uint8_t *e = item.field.data;
+        const uint8_t *end = e + item.field.len;
+        struct pbfile_item kv;
+        uint64_t bearing = 0, range = 0;
+        while ((rc = pbfile_next(&e, end, &kv)) == 1) {
+            if (kv.number == 1) {
+                bearing = kv.varint;
+            } else if (kv.number == 2) {
+                range = kv.varint;
+            }
+        }
+        if (rc == -1) {
+            return -1;
+        }
+        unsigned bin = (unsigned) (bearing % 360) / POLAR_RESOLUTION;
+        if (range > map->range[bin]) {
+            map->range[bin] = range > UINT32_MAX ? UINT32_MAX : (uint32_t) range;
+        }
+    }
+    return rc;
+}
+
+/**
+ * Merge map into all-time maximum map.
+ * @param dst Maximum map.
+ * @param src Current map.
+ * @return Number of bins increased.
+ */
+int polar_merge(struct polar_map *dst, const struct polar_map *src) {
+    int changed = 0;
+    for (int i = 0; i < POLAR_BINS; ++i) {
+        if (src->range[i] > dst->range[i]) {
+            dst->range[i] = src->range[i];
+            changed++;
+        }
+    }
+    return changed;
+}
+
+/**
+ * Write full map payload, bins are packed in bearing order.
+ * {"res":5,"bins":[r0,r1,...]}
+ * @param json Writer.
+ * @param map Map.
+ */
+void polar_json(struct json *json, const struct polar_map *map) {
+    char buf[FMT_BUF_SIZE];
+
+    json_object_begin(json);
+    json_key(json, "res");
+    json_raw(json, buf, fmt_u64(buf, POLAR_RESOLUTION));
+    json_key(json, "bins");
+    json_array_begin(json);
+    for (int i = 0; i < POLAR_BINS; ++i) {
+        json_raw(json, buf, fmt_u64(buf, map->range[i]));
+    }
+    json_array_end(json);
+    json_object_end(json);
+}
+
+/**
+ * Write payload with bins changed since the last sent map, packed as
+ * index and range pairs. {"res":5,"changed":[i0,r0,i1,r1,...]}
+ * @param json Writer.
+ * @param map Current map.
+ * @param sent Last sent map.
+ * @return Number of changed bins, nothing is written when zero.
+ */
+int polar_json_delta(struct json *json, const struct polar_map *map, const struct polar_map *sent) {
+    char buf[FMT_BUF_SIZE];
+    int changed = 0;
+
+    for (int i = 0; i < POLAR_BINS; ++i) {
+        if (map->range[i] == sent->range[i]) {
+            continue;
+        }
+        if (changed++ == 0) {
+            json_object_begin(json);
+            json_key(json, "res");
+            json_raw(json, buf, fmt_u64(buf, POLAR_RESOLUTION));
+            json_key(json, "changed");
+            json_array_begin(json);
+        }
+        json_raw(json, buf, fmt_u64(buf, (uint64_t) i));
+        json_raw(json, buf, fmt_u64(buf, map->range[i]));
+    }
+    if (changed) {
+        json_array_end(json);
+        json_object_end(json);
+    }
+    return changed;
+}
+
+/**
+ * Load map from file, one "<bearing> <range>" line per bin.
+ * A missing file gives an empty map.
+ * @param map Returns map.
+ * @param path File name.
+ * @return Zero on success, -1 on error.
+ */
+int polar_load(struct polar_map *map, const char *path) {
+    unsigned bearing, range;
+    char line[64];
+
+    memset(map, 0, sizeof (*map));
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        if (errno == ENOENT) {
+            return 0;
+        }
+        fprintf(stderr, "cannot open file %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    while (fgets(line, sizeof (line), f)) {
+        if (line[0] == '#') {
+            continue;
+        }
+        if (sscanf(line, "%u %u", &bearing, &range) != 2) {
+            fprintf(stderr, "invalid line in %s: %s", path, line);
+            fclose(f);
+            return -1;
+        }
+        unsigned bin = (bearing % 360) / POLAR_RESOLUTION;
+        if (range > map->range[bin]) {
+            map->range[bin] = range;
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+/**
+ * Save map to file atomically. A temporary file is written and synced,
+ * then renamed over the previous one, so a crash leaves either map.
+ * @param map Map.
+ * @param path File name.
+ * @return Zero on success, -1 on error.
+ */
+int polar_save(const struct polar_map *map, const char *path) {
+    char tmp[POLAR_PATH_SIZE];
+
+    if (snprintf(tmp, sizeof (tmp), "%s.tmp", path) >= (int) sizeof (tmp)) {
+        fprintf(stderr, "file name %s too long\n", path);
+        return -1;
+    }
+    FILE *f = fopen(tmp, "w");
+    if (f == NULL) {
+        fprintf(stderr, "cannot create file %s: %s\n", tmp, strerror(errno));
+        return -1;
+    }
+    fprintf(f, "# readsbmqtt all-time polar range, <bearing> <range>\n");
+    for (int i = 0; i < POLAR_BINS; ++i) {
+        fprintf(f, "%d %u\n", i * POLAR_RESOLUTION, map->range[i]);
+    }
+    if (fflush(f) != 0 || fsync(fileno(f)) == -1) {
+        fprintf(stderr, "cannot write file %s: %s\n", tmp, strerror(errno));
+        fclose(f);
+        unlink(tmp);
+        return -1;
+    }
+    if (fclose(f) != 0 || rename(tmp, path) == -1) {
+        fprintf(stderr, "cannot replace file %s: %s\n", path, strerror(errno));
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
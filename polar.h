@@ -0,0 +1,43 @@
+// Part of readsbmqtt, an MQTT client that reads statistics from readsb
+// ADS-B decoder and forward them via MQTT broker into home assistant (HASS)
+//
+// polar.h: Polar range (coverage) map from readsb statistics. (header)
+//
+// Copyright (c) 2022 Michael Wolf <michael@mictronics.de>
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef POLAR_H
+#define POLAR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "json.h"
+
+#define POLAR_RESOLUTION    5   // Degree per bin
+#define POLAR_BINS          (360 / POLAR_RESOLUTION)
+
+// Maximum range per bearing bin, bin 0 starts at north
+struct polar_map {
+    uint32_t range[POLAR_BINS];
+};
+
+int polar_decode(struct polar_map *map, const uint8_t *data, size_t len, uint32_t field);
+int polar_merge(struct polar_map *dst, const struct polar_map *src);
+void polar_json(struct json *json, const struct polar_map *map);
+int polar_json_delta(struct json *json, const struct polar_map *map, const struct polar_map *sent);
+int polar_load(struct polar_map *map, const char *path);
+int polar_save(const struct polar_map *map, const char *path);
+
+#endif /* POLAR_H */
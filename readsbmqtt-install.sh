@@ -3,7 +3,7 @@ set -e
 
 DIR=$( cd -- "$( dirname -- "${BASH_SOURCE[0]}" )" &> /dev/null && pwd )
 BIN=/usr/bin/readsbmqtt
-DEP="git build-essential libprotobuf-c-dev protobuf-c-compiler"
+DEP="git build-essential libprotobuf-c-dev protobuf-c-compiler zlib1g-dev"
 PAHO="https://github.com/eclipse/paho.mqtt.c"
 
 apt install -y $DEP || apt update && apt install -y $DEP || true
@@ -19,7 +19,7 @@ fi
 cd /tmp/paho.mqtt.c && make && make install && ldconfig
 
 cd "$DIR"
-make
+make release
 
 if [ -f "readsbmqtt" ]
 then
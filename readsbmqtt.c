@@ -20,24 +20,95 @@
 
 #include "readsbmqtt.h"
 
-static int app_exit = 0;
-static int app_return_code = EXIT_SUCCESS;
-static int new_stats = 0;
-static uint64_t last_timestamp = 0;
-static int feeder_status = 0;
-static int inotify_fd;
+static volatile sig_atomic_t app_exit = 0;
+static volatile sig_atomic_t app_return_code = EXIT_SUCCESS;
+static int heartbeat_interval = HEARTBEAT_INTERVAL;
+static int snapshot_interval = SNAPSHOT_INTERVAL;
+static int diagnostics_interval = 0;
+static time_t last_diagnostics;
+static char *deadband_args[MAX_DEADBANDS];
+static int num_deadbands = 0;
+static struct sensor_table sensors;
+static int temperature_sensor = -1;
+static char *export_args[MAX_FIELD_ARGS];
+static int num_exports = 0;
+static char *exclude_args[MAX_FIELD_ARGS];
+static int num_excludes = 0;
+static int polar_enabled = 0;
+static char *polar_max_file;
+static int aircraft_enabled = 0;
+static int raw_enabled = 0;
+static const char *compress_groups[NUM_COMPRESS_GROUPS] = {"raw", "aircraft", "windows", "polar"};
+static const struct codec_ops *compress_ops[NUM_COMPRESS_GROUPS];
+static int compress_level[NUM_COMPRESS_GROUPS];
+static struct codec compressors[NUM_COMPRESS_GROUPS]; // Set up once, ops NULL when not compressed
+static char *receiver_args[MAX_RECEIVERS];
+static int num_receiver_args = 0;
+static struct receiver receivers[MAX_RECEIVERS];
+static int num_receivers = 0;
+static int inotify_fd = -1;
+static int broker_fd = -1;
 static error_t parse_opt(int key, char *arg, struct argp_state *state);
+static void flush_spool(MQTTAsync client);
 const char *argp_program_version = "readsbmqtt v1.0.0";
 const char doc[] = "Readsb MQTT statistics client";
 const char args_doc[] = "";
 static struct argp argp = {options, parse_opt, args_doc, doc, NULL, NULL, NULL};
 
-MQTTClient_deliveryToken delivered_token;
-MQTTClient_connectOptions connect_options = MQTTClient_connectOptions_initializer;
+MQTTAsync_connectOptions connect_options = MQTTAsync_connectOptions_initializer;
+static MQTTAsync_willOptions lwt_options = MQTTAsync_willOptions_initializer;
 static char *server_uri;
 static char *client_id;
 static char *topic_prefix;
+static char *hass_status_topic;
+static pthread_mutex_t hass_status_lock = PTHREAD_MUTEX_INITIALIZER; // Topic is compared by MQTT client thread
+static char *config_path;
+static const char *config_name; // File name part of config_path
+static int config_wd = -1; // Watch on the directory of config_path
+static int config_pending = 0;
+static struct settings base_settings; // From command line
+static struct settings active_settings; // Command line and config file, in use
+static atomic_int discovery_pending = 0;
+static pthread_t decode_thread;
+static int decode_fd = -1; // Wakes decode worker, blocking
+static int decoded_fd = -1; // Wakes event loop when frames are ready
+static atomic_int decode_exit = 0;
+static struct topic_table topics;
+static struct interned availability_topic; // Last will of all receivers, fixed for the process
+static struct arena aircraft_arena;
+static struct pbfile aircraft_file;
 static char payload[MAX_PAYLOAD_SIZE];
+static int inflight_window = INFLIGHT_WINDOW;
+static struct inflight_msg *inflight;
+static int inflight_head = 0; // Next slot to use
+static int inflight_count = 0; // Slots in use, oldest is inflight_count slots before head
+static struct publish_stats pub_stats;
+static struct pipeline_metrics metrics;
+static char *exporter_addr;
+static struct exporter exporter;
+static struct sensor_table export_sensors; // All numeric fields, unscaled
+static int exporter_dirty = 0;
+
+// Pipeline stages in diagnostics and exporter output
+static const struct {
+    const char *name;
+    struct histogram *h;
+} pipeline_stages[] = {
+    {"wait", &metrics.wait},
+    {"read", &metrics.read},
+    {"decode", &metrics.decode},
+    {"build", &metrics.build},
+    {"ack", &metrics.ack}
+};
+static atomic_int connect_result = 1; // 1: pending, 0: connected, <0: failed
+static atomic_int link_lost = 0; // Set by MQTT client thread on connection loss
+static atomic_int publish_failed = 0; // Set by MQTT client thread, folded into app_return_code by the event loop
+static int broker_state = BROKER_CONNECTING;
+static int broker_timer_fd = -1; // Reconnect delay and queue flush ticks
+static int reconnect_attempt = 0;
+static char *spool_path;
+static size_t spool_size = (size_t) SPOOL_SIZE * 1024 * 1024;
+static struct spool spool = {.fd = -1};
 
 /**
  * Signal handler
@@ -50,6 +121,28 @@ static void signal_handler(int sig) {
     fprintf(stderr, "caught signal %s, shutting down..\n", strsignal(sig));
 }
 
+/**
+ * Parse statistics window option <window>=<seconds>.
+ * @param arg Option argument.
+ * @param w Returns window index.
+ * @param interval Returns interval.
+ * @return Zero on success, -1 on invalid argument.
+ */
+static int parse_window(const char *arg, int *w, int *interval) {
+    const char *eq = strchr(arg, '=');
+    if (eq == NULL || eq[1] < '0' || eq[1] > '9') {
+        return -1;
+    }
+    for (*w = 0; *w < NUM_STATS_WINDOWS; ++*w) {
+        if (strlen(stats_windows[*w].name) == (size_t) (eq - arg)
+                && strncmp(stats_windows[*w].name, arg, (size_t) (eq - arg)) == 0) {
+            *interval = atoi(eq + 1);
+            return 0;
+        }
+    }
+    return -1;
+}
+
 /**
  * Command line option parser.
  * @param key Option key.
@@ -60,6 +153,9 @@ static void signal_handler(int sig) {
  */
 static error_t parse_opt(int key, char *arg, struct argp_state *state) {
     switch (key) {
+        case 'c':
+            config_path = strdup(arg);
+            break;
         case 'b':
             server_uri = strndup(arg, MAX_URI_SIZE);
             break;
@@ -75,6 +171,117 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
         case 't':
             topic_prefix = strndup(arg, MAX_TOPIC_SIZE);
             break;
+        case 'r':
+            if (num_receiver_args == MAX_RECEIVERS) {
+                argp_error(state, "too many receivers, maximum is %d", MAX_RECEIVERS);
+            }
+            receiver_args[num_receiver_args++] = arg;
+            break;
+        case 'a':
+            aircraft_enabled = 1;
+            break;
+        case 'R':
+            raw_enabled = 1;
+            break;
+        case 'z':
+        {
+            size_t name_len = strcspn(arg, ":=");
+            const char *p = arg + name_len;
+            char codec[16] = "zlib";
+            int g = 0;
+            while (g < NUM_COMPRESS_GROUPS && (strlen(compress_groups[g]) != name_len
+                    || strncmp(compress_groups[g], arg, name_len) != 0)) {
+                g++;
+            }
+            if (g == NUM_COMPRESS_GROUPS) {
+                argp_error(state, "unknown compress topic group %.*s", (int) name_len, arg);
+                break;
+            }
+            if (*p == ':') {
+                size_t codec_len = strcspn(p + 1, "=");
+                snprintf(codec, sizeof (codec), "%.*s", (int) codec_len, p + 1);
+                p += 1 + codec_len;
+            }
+            compress_ops[g] = codec_find(codec);
+            if (compress_ops[g] == NULL) {
+                argp_error(state, "unknown codec %s", codec);
+                break;
+            }
+            compress_level[g] = *p == '=' ? atoi(p + 1) : 0;
+            if (*p == '=' && (compress_level[g] < compress_ops[g]->min_level || compress_level[g] > compress_ops[g]->max_level)) {
+                argp_error(state, "invalid compression level %s", p + 1);
+            }
+            break;
+        }
+        case 'P':
+            polar_enabled = 1;
+            break;
+        case 'M':
+            polar_enabled = 1;
+            polar_max_file = strdup(arg);
+            break;
+        case 'd':
+            if (num_deadbands == MAX_DEADBANDS) {
+                argp_error(state, "too many deadbands, maximum is %d", MAX_DEADBANDS);
+            }
+            deadband_args[num_deadbands++] = arg;
+            break;
+        case 'e':
+            if (num_exports == MAX_FIELD_ARGS) {
+                argp_error(state, "too many exported fields, maximum is %d", MAX_FIELD_ARGS);
+            }
+            export_args[num_exports++] = arg;
+            break;
+        case 'x':
+            if (num_excludes == MAX_FIELD_ARGS) {
+                argp_error(state, "too many excluded fields, maximum is %d", MAX_FIELD_ARGS);
+            }
+            exclude_args[num_excludes++] = arg;
+            break;
+        case 'W':
+        {
+            int w, interval;
+            if (parse_window(arg, &w, &interval) == -1) {
+                argp_error(state, "invalid statistics window %s", arg);
+                break;
+            }
+            stats_windows[w].interval = interval;
+            break;
+        }
+        case 'H':
+            heartbeat_interval = atoi(arg);
+            break;
+        case 'S':
+            snapshot_interval = atoi(arg);
+            break;
+        case 'D':
+            diagnostics_interval = atoi(arg);
+            break;
+        case 'E':
+            exporter_addr = strdup(arg);
+            break;
+        case 'Q':
+        {
+            char *eq = strrchr(arg, '=');
+            spool_path = strndup(arg, eq ? (size_t) (eq - arg) : strlen(arg));
+            if (eq) {
+                int mib = atoi(eq + 1);
+                if (mib < 1) {
+                    argp_error(state, "invalid queue size %s", eq + 1);
+                }
+                spool_size = (size_t) mib * 1024 * 1024;
+            }
+            break;
+        }
+        case 's':
+            hass_status_topic = strndup(arg, MAX_TOPIC_SIZE);
+            break;
+        case 'w':
+            inflight_window = atoi(arg);
+            if (inflight_window < 1 || inflight_window > MAX_INFLIGHT_WINDOW) {
+                argp_error(state, "in-flight window must be 1..%d", MAX_INFLIGHT_WINDOW);
+            }
+            break;
         case ARGP_KEY_END:
             if (state->arg_num > 0)
                 /* We use only options but no arguments */
@@ -87,359 +294,2779 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
 }
 
 /**
- * Message delivered callback.
+ * Get monotonic clock time in microseconds.
+ * @return Microseconds since some unspecified starting point.
+ */
+static uint64_t monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+}
+
+/**
+ * Wake up the event loop from MQTT client thread.
+ */
+static void broker_notify(void) {
+    uint64_t one = 1;
+    if (write(broker_fd, &one, sizeof (one)) == -1) {
+        fprintf(stderr, "broker event write error: %s\n", strerror(errno));
+    }
+}
+
+/**
+ * Wait for broker event from MQTT client thread.
+ * @param timeout Timeout in milliseconds.
+ * @return Non zero if an event occurred.
+ */
+static int broker_wait(int timeout) {
+    struct pollfd pfd = {.fd = broker_fd, .events = POLLIN};
+    uint64_t count;
+    if (poll(&pfd, 1, timeout) <= 0) {
+        return 0;
+    }
+    if (read(broker_fd, &count, sizeof (count)) == -1 && errno != EAGAIN) {
+        fprintf(stderr, "broker event read error: %s\n", strerror(errno));
+    }
+    return 1;
+}
+
+/**
+ * Connect success callback.
  * @param context Application specific context
- * @param dt Delivery token
+ * @param response Connect response data
  */
-static void msg_delivered(void *context, MQTTClient_deliveryToken dt) {
+static void on_connect(void *context, MQTTAsync_successData *response) {
     NOTUSED(context);
-    delivered_token = dt;
+    NOTUSED(response);
+    atomic_store(&connect_result, 0);
+    broker_notify();
 }
 
 /**
- * Messager arrived callback.
+ * Connect failure callback.
  * @param context Application specific context
- * @param topic_name Message topic
- * @param topic_length Message topic length
- * @param message Arrived message.
- * @return 
+ * @param response Failure response data
  */
-static int msg_arrived(void *context, char *topic_name, int topic_length, MQTTClient_message *message) {
+static void on_connect_failure(void *context, MQTTAsync_failureData *response) {
     NOTUSED(context);
-    NOTUSED(topic_length);
-    fprintf(stderr, "got message\ntopic %s\n", topic_name);
-    fprintf(stderr, "payload %.*s\n", message->payloadlen, (char*) message->payload);
-    MQTTClient_freeMessage(&message);
-    MQTTClient_free(topic_name);
-    return 1;
+    fprintf(stderr, "connect error: %d %s\n", response ? response->code : 0,
+            response && response->message ? response->message : "");
+    atomic_store(&connect_result, -1);
+    broker_notify();
 }
 
 /**
- * Connection lost callback
+ * Disconnect success callback.
  * @param context Application specific context
- * @param cause of connection lost
+ * @param response Response data
  */
-static void connection_lost(void *context, char *cause) {
+static void on_disconnect(void *context, MQTTAsync_successData *response) {
     NOTUSED(context);
-    fprintf(stderr, "connection lost: %s\n", cause);
-    app_exit = 1;
-    app_return_code = EXIT_FAILURE;
+    NOTUSED(response);
+    broker_notify();
+}
+
+/**
+ * Disconnect failure callback.
+ * @param context Application specific context
+ * @param response Failure response data
+ */
+static void on_disconnect_failure(void *context, MQTTAsync_failureData *response) {
+    NOTUSED(context);
+    fprintf(stderr, "disconnect error: %d\n", response ? response->code : 0);
+    broker_notify();
 }
 
 /**
- * Read and process readsb stats.pb file.
- * @param file_name Absolute path and file name.
+ * Complete in-flight slot from a publish callback, unless the slot was reset
+ * and reused since the message was sent.
+ * @param context Slot index and generation of the message.
+ * @param state INFLIGHT_ACKED or INFLIGHT_FAILED.
+ * @return Slot, NULL when the callback is stale.
  */
-static void update_from_stats(const char *file_name) {
-    struct stat st;
-    off_t file_size = 0;
-    static uint8_t *read_buf;
-    static Statistics *stats_msg;
+static struct inflight_msg *inflight_complete(void *context, unsigned state) {
+    struct inflight_msg *msg = &inflight[(uintptr_t) context & 0xffff];
+    unsigned generation = (unsigned) ((uintptr_t) context >> 16) & 0xffff;
+    unsigned busy = generation << 2 | INFLIGHT_BUSY;
+    return atomic_compare_exchange_strong(&msg->state, &busy, generation << 2 | state) ? msg : NULL;
+}
 
-    if (stat(file_name, &st) == 0) {
-        file_size = st.st_size;
-    } else {
-        fprintf(stderr, "cannot determine size of %s: %s\n", file_name, strerror(errno));
-        return;
+/**
+ * Message delivered callback.
+ * @param context Slot index and generation of the message
+ * @param response Success response data
+ */
+static void on_publish(void *context, MQTTAsync_successData *response) {
+    struct inflight_msg *msg = &inflight[(uintptr_t) context & 0xffff];
+    uint64_t sent_us = atomic_load(&msg->sent_us); // Before the slot can be reused
+    NOTUSED(response);
+    if (inflight_complete(context, INFLIGHT_ACKED)) {
+        histogram_add(&metrics.ack, monotonic_us() - sent_us);
+        atomic_fetch_add(&pub_stats.acked, 1);
     }
+    // Event loop frees the slot and sends what waits for it.
+    broker_notify();
+}
 
-    int fd = open(file_name, O_RDONLY);
-    if (fd == -1) {
-        fprintf(stderr, "cannot open file %s: %s\n", file_name, strerror(errno));
-        return;
+/**
+ * Message delivery failed callback.
+ * @param context Slot index and generation of the message
+ * @param response Failure response data
+ */
+static void on_publish_failure(void *context, MQTTAsync_failureData *response) {
+    if (inflight_complete(context, INFLIGHT_FAILED)) {
+        fprintf(stderr, "publish error: %d %s\n", response ? response->code : 0,
+                response && response->message ? response->message : "");
+        atomic_fetch_add(&pub_stats.failed, 1);
+        atomic_store(&publish_failed, 1);
     }
+    broker_notify();
+}
 
-    read_buf = (uint8_t *) malloc(file_size);
-    if (read_buf == NULL) {
-        fprintf(stderr, "unable to allocated read buffer for %s\n", file_name);
-        close(fd);
-        return;
+/**
+ * Free completed slots of the in-flight window, oldest first.
+ * Called by the event loop when woken by a publish callback. Queued
+ * messages are removed from the queue once acknowledged, in order.
+ * A failed queued message is sent again with all queued messages after it.
+ */
+static void inflight_reap(void) {
+    while (inflight_count > 0) {
+        int tail = (inflight_head - inflight_count + inflight_window) % inflight_window;
+        struct inflight_msg *msg = &inflight[tail];
+        unsigned state = atomic_load(&msg->state);
+        if ((state & 3) == INFLIGHT_BUSY) {
+            break;
+        }
+        if ((state & 3) == INFLIGHT_FAILED) {
+            fprintf(stderr, "publish %s failed\n", msg->topic);
+            if (msg->spool_end) {
+                for (int i = 0; i < inflight_count; ++i) {
+                    inflight[(tail + i) % inflight_window].spool_end = 0;
+                }
+                spool_rewind(&spool);
+            }
+        } else if (msg->spool_end) {
+            spool_commit(&spool, msg->spool_end);
+        }
+        msg->spool_end = 0;
+        atomic_store(&msg->state, (state & ~3u) | INFLIGHT_FREE);
+        inflight_count--;
+    }
+}
+
+/**
+ * Free all slots, messages in flight are lost with the clean session.
+ * Late callbacks of these messages do not match the next use of the slot.
+ * Queued messages not acknowledged are sent again after reconnect.
+ */
+static void inflight_reset(void) {
+    for (int i = 0; i < inflight_window; ++i) {
+        atomic_store(&inflight[i].state, (atomic_load(&inflight[i].state) & ~3u) | INFLIGHT_FREE);
+        inflight[i].spool_end = 0;
     }
+    inflight_count = 0;
+    spool_rewind(&spool);
+}
 
-    file_size = read(fd, read_buf, file_size);
-    close(fd);
+/**
+ * @return Non zero when no QoS 1 message can be sent before a slot is freed.
+ */
+static int inflight_full(void) {
+    return inflight_count == inflight_window;
+}
 
-    if (file_size == 0) {
-        return;
+/**
+ * Send message to broker without waiting for delivery.
+ * QoS 1 messages need a free slot of the in-flight window, see inflight_full().
+ * @param client MQTT client.
+ * @param topic Message topic.
+ * @param data Message payload.
+ * @param len Payload length.
+ * @param qos Quality of service, QoS 0 messages bypass the in-flight window.
+ * @param retained Broker shall retain the message.
+ * @param spool_end Offset behind a queued message, committed when acknowledged, 0 when not queued.
+ * @return MQTTASYNC_SUCCESS or error code.
+ */
+static int publish_now(MQTTAsync client, const char *topic, const void *data, int len, int qos, int retained, off_t spool_end) {
+    MQTTAsync_responseOptions opts = MQTTAsync_responseOptions_initializer;
+    struct inflight_msg *msg = &inflight[inflight_head];
+    int mqtt_rc;
+
+    if (qos == 0) {
+        if ((mqtt_rc = MQTTAsync_send(client, topic, len, data, 0, retained, NULL)) != MQTTASYNC_SUCCESS) {
+            fprintf(stderr, "publish %s error: %s\n", topic, MQTTAsync_strerror(mqtt_rc));
+            atomic_fetch_add(&pub_stats.failed, 1);
+            return mqtt_rc;
+        }
+        atomic_fetch_add(&pub_stats.sent, 1);
+        atomic_fetch_add(&pub_stats.bytes, (uint_fast64_t) len);
+        return MQTTASYNC_SUCCESS;
     }
 
-    stats_msg = statistics__unpack(NULL, file_size, read_buf);
-    free(read_buf);
-    if (stats_msg == NULL) {
-        fprintf(stderr, "unpacking statistics message failed\n");
-        return;
+    if (inflight_full()) {
+        fprintf(stderr, "publish %s error: in-flight window full\n", topic);
+        atomic_fetch_add(&pub_stats.failed, 1);
+        return MQTTASYNC_FAILURE;
     }
 
-    if (stats_msg->last_1min->stop - last_timestamp > 90) {
-        feeder_status = 0;
-    } else {
-        feeder_status = 1;
-    }
-    last_timestamp = stats_msg->last_1min->stop;
-    statistics[0].val = (double) stats_msg->last_1min->messages;
-    statistics[1].val = (double) stats_msg->last_1min->tracks_new;
-    statistics[2].val = (double) stats_msg->last_1min->tracks_single_message;
-    statistics[3].val = (double) stats_msg->last_1min->tracks_mlat_position;
-    statistics[4].val = (double) stats_msg->last_1min->tracks_with_position;
-    statistics[5].val = (double) stats_msg->last_1min->max_distance_in_metres / 1000;
-    statistics[6].val = (double) stats_msg->last_1min->max_distance_in_nautical_miles;
-    statistics[7].val = (double) stats_msg->last_1min->local_strong_signals;
-    statistics[8].val = (double) stats_msg->last_1min->local_signal;
-    statistics[9].val = (double) stats_msg->last_1min->local_noise;
-    statistics[10].val = (double) stats_msg->last_1min->local_peak_signal;
-    statistics__free_unpacked(stats_msg, NULL);
-
-    fd = open("/sys/class/hwmon/hwmon0/temp1_input", O_RDONLY);
-    char buf[10] = {0};
-    float temp;
-    if (read(fd, buf, 10)) {
-        sscanf(buf, "%f", &temp);
-        statistics[11].val = (double) (temp / 1000);
+    // Slot is set up before sending, the callback may run before send returns.
+    msg->generation = (msg->generation + 1) & 0xffff;
+    strncpy(msg->topic, topic, MAX_TOPIC_SIZE - 1);
+    msg->topic[MAX_TOPIC_SIZE - 1] = '\0';
+    atomic_store(&msg->sent_us, monotonic_us());
+    msg->spool_end = spool_end;
+    atomic_store(&msg->state, msg->generation << 2 | INFLIGHT_BUSY);
+    opts.onSuccess = on_publish;
+    opts.onFailure = on_publish_failure;
+    opts.context = (void *) (uintptr_t) (msg->generation << 16 | (unsigned) inflight_head);
+    if ((mqtt_rc = MQTTAsync_send(client, topic, len, data, qos, retained, &opts)) != MQTTASYNC_SUCCESS) {
+        fprintf(stderr, "publish %s error: %s\n", topic, MQTTAsync_strerror(mqtt_rc));
+        atomic_fetch_add(&pub_stats.failed, 1);
+        atomic_store(&msg->state, msg->generation << 2 | INFLIGHT_FREE);
+        msg->spool_end = 0;
+        return mqtt_rc;
     }
-    close(fd);
+    inflight_head = (inflight_head + 1) % inflight_window;
+    inflight_count++;
+    atomic_fetch_add(&pub_stats.sent, 1);
+    atomic_fetch_add(&pub_stats.bytes, (uint_fast64_t) len);
+    return MQTTASYNC_SUCCESS;
 }
 
 /**
- * Signal IO handler
- * @param sig Signal number we got
+ * Publish message through the queue.
+ * QoS 1 messages are appended to the queue and sent from it in order, as
+ * far as the in-flight window allows. They stay queued until acknowledged,
+ * a message that fails is sent again with all messages after it. The event
+ * loop sends the rest as slots are freed, publishing never waits. Without
+ * queue file the queue is in memory and takes messages only while connected.
+ * QoS 0 messages are live state only and dropped while disconnected.
+ * @param client MQTT client.
+ * @param topic Message topic.
+ * @param data Message payload.
+ * @param len Payload length.
+ * @param qos Quality of service.
+ * @param retained Broker shall retain the message.
+ * @return MQTTASYNC_SUCCESS when sent or queued, error code otherwise.
  */
-static void signal_io_handler(int sig) {
-    NOTUSED(sig);
-    char buf[BUF_LEN] __attribute__ ((aligned(8)));
-    ssize_t numRead = read(inotify_fd, buf, BUF_LEN);
-    /* Process all of the events in buffer returned by read() */
-    for (char *p = buf; p < buf + numRead;) {
-        struct inotify_event *event = (struct inotify_event *) p;
-        if (strcmp(event->name, "stats.pb") == 0) {
-            // We got a new stats.pb from temp file
-            if (event->mask & IN_MOVED_TO) {
-                update_from_stats(READSB_STATS_FILE_PB);
-                new_stats = 1;
-            }
-            // stats.pb deleted, readsb stopped?
-            if (event->mask & IN_DELETE) {
-                fprintf(stderr, "error stats.pb deleted. readsb stopped?\n");
-                app_exit = 1;
-                app_return_code = EXIT_FAILURE;
-            }
+static int publish(MQTTAsync client, const char *topic, const void *data, int len, int qos, int retained) {
+    if (qos == 0 && broker_state == BROKER_CONNECTED) {
+        return publish_now(client, topic, data, len, qos, retained, 0);
+    }
+    if (qos == 0 || (!spool_path && broker_state != BROKER_CONNECTED)
+            || spool_append(&spool, topic, data, len, qos, retained) == -1) {
+        atomic_fetch_add(&pub_stats.failed, 1);
+        return broker_state == BROKER_CONNECTED ? MQTTASYNC_FAILURE : MQTTASYNC_DISCONNECTED;
+    }
+    if (broker_state == BROKER_CONNECTED && !inflight_full()) {
+        flush_spool(client);
+    }
+    return MQTTASYNC_SUCCESS;
+}
+
+/**
+ * Publish message of a topic group, compressed when enabled for the group.
+ * Payloads that do not get smaller are sent plain.
+ * @param client MQTT client.
+ * @param group Topic group, COMPRESS_*.
+ * @param topic Message topic.
+ * @param data Message payload.
+ * @param len Payload length.
+ * @param qos Quality of service.
+ * @param retained Broker shall retain the message.
+ * @return MQTTASYNC_SUCCESS when sent or queued, error code otherwise.
+ */
+static int publish_group(MQTTAsync client, int group, const char *topic, const void *data, int len, int qos, int retained) {
+    struct codec *c = &compressors[group];
+    if (c->ops) {
+        size_t out_len;
+        const uint8_t *out = codec_compress(c, data, (size_t) len, &out_len);
+        if (out) {
+            return publish(client, topic, out, (int) out_len, qos, retained);
         }
-        p += sizeof (struct inotify_event) +event->len;
     }
+    return publish(client, topic, data, len, qos, retained);
 }
 
-int main(int argc, char* argv[]) {
-    MQTTClient client;
-    MQTTClient_message pubmsg = MQTTClient_message_initializer;
-    MQTTClient_willOptions lwt_options = MQTTClient_willOptions_initializer;
-    MQTTClient_deliveryToken token;
-    int len, mqtt_rc;
-    char topic[MAX_TOPIC_SIZE];
+/**
+ * Wait until at most max_count messages are in flight. Used on shutdown
+ * only, after the event loop stopped.
+ * @param max_count Messages allowed to stay in flight.
+ * @param timeout Timeout in milliseconds.
+ */
+static void inflight_drain(int max_count, int timeout) {
+    uint64_t deadline = monotonic_us() + (uint64_t) timeout * 1000;
+    inflight_reap();
+    while (inflight_count > max_count) {
+        uint64_t now = monotonic_us();
+        if (now >= deadline || !broker_wait((int) ((deadline - now) / 1000) + 1)) {
+            break;
+        }
+        inflight_reap();
+    }
+}
 
-    // General signal handlers:
-    signal(SIGINT, signal_handler);
-    signal(SIGTERM, signal_handler);
-    signal(SIGABRT, signal_handler);
+/**
+ * Messager arrived callback.
+ * HASS publishes "online" to its status topic after start, discovery configs
+ * are send again when the event loop wakes up.
+ * @param context Application specific context
+ * @param topic_name Message topic
+ * @param topic_length Message topic length
+ * @param message Arrived message.
+ * @return 
+ */
+static int msg_arrived(void *context, char *topic_name, int topic_length, MQTTAsync_message *message) {
+    NOTUSED(context);
+    size_t len = topic_length ? (size_t) topic_length : strlen(topic_name);
+    pthread_mutex_lock(&hass_status_lock);
+    int hass_status = len == strlen(hass_status_topic) && memcmp(topic_name, hass_status_topic, len) == 0;
+    pthread_mutex_unlock(&hass_status_lock);
+    if (hass_status) {
+        if ((size_t) message->payloadlen == strlen(HASS_STATUS_ONLINE)
+                && memcmp(message->payload, HASS_STATUS_ONLINE, (size_t) message->payloadlen) == 0) {
+            atomic_store(&discovery_pending, 1);
+            broker_notify();
+        }
+    } else {
+        fprintf(stderr, "unexpected message on topic %.*s\n", (int) len, topic_name);
+    }
+    MQTTAsync_freeMessage(&message);
+    MQTTAsync_free(topic_name);
+    return 1;
+}
 
-    // Set defaults
-    server_uri = strdup("tcp://localhost:1883");
-    client_id = strdup("feeder001");
-    topic_prefix = strdup("homeassistant/sensor");
+/**
+ * Connection lost callback
+ * @param context Application specific context
+ * @param cause of connection lost
+ */
+static void connection_lost(void *context, char *cause) {
+    NOTUSED(context);
+    fprintf(stderr, "connection lost: %s\n", cause ? cause : "unknown");
+    atomic_store(&link_lost, 1);
+    broker_notify();
+}
 
-    // Create last will: client not running
-    snprintf(topic, MAX_TOPIC_SIZE, MQTT_TOPIC_PROPERTIES, topic_prefix, client_id);
-    lwt_options.topicName = topic;
-    lwt_options.message = "{\"running\": \"0\"}\0";
-    lwt_options.qos = QOS;
+/**
+ * Get monotonic clock time in seconds.
+ * @return Seconds since some unspecified starting point.
+ */
+static time_t monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
 
-    // Parse the command line options
-    if (argp_parse(&argp, argc, argv, 0, 0, 0)) {
-        return EXIT_FAILURE;
+/**
+ * Publish file content unchanged, straight from the read buffer or mapping.
+ * QoS 0, so the client library takes its own copy and the buffer can be
+ * released right after.
+ * @param client MQTT client.
+ * @param topic Binary topic.
+ * @param data File content.
+ * @param len Content length.
+ */
+static void publish_raw(MQTTAsync client, const char *topic, const uint8_t *data, size_t len) {
+    if (len > INT_MAX) {
+        return;
     }
+    publish_group(client, COMPRESS_RAW, topic, data, (int) len, 0, 0);
+}
 
-    if ((mqtt_rc = MQTTClient_create(&client, server_uri, client_id, MQTTCLIENT_PERSISTENCE_NONE, NULL)) != MQTTCLIENT_SUCCESS) {
-        fprintf(stderr, "create client error: %d\n", mqtt_rc);
-        app_return_code = EXIT_FAILURE;
-        goto exit;
+/**
+ * Take a free frame of a receiver for decoding.
+ * @param rx Receiver.
+ * @return Frame, NULL when both are busy, which does not happen with one
+ * decode worker and the event loop holding at most one frame.
+ */
+static struct stats_frame *frame_acquire(struct receiver *rx) {
+    for (int i = 0; i < 2; ++i) {
+        int state = FRAME_FREE;
+        if (atomic_compare_exchange_strong(&rx->frames[i].state, &state, FRAME_WRITING)) {
+            return &rx->frames[i];
+        }
     }
+    return NULL;
+}
 
-    if ((mqtt_rc = MQTTClient_setCallbacks(client, NULL, connection_lost, msg_arrived, msg_delivered)) != MQTTCLIENT_SUCCESS) {
-        fprintf(stderr, "set callbacks error: %d\n", mqtt_rc);
-        app_return_code = EXIT_FAILURE;
-        goto destroy_exit;
-    }
+/**
+ * @return Non zero when a decoded frame waits for the event loop.
+ */
+static int frame_ready(struct receiver *rx) {
+    return atomic_load(&rx->frames[0].state) == FRAME_READY || atomic_load(&rx->frames[1].state) == FRAME_READY;
+}
 
-    connect_options.keepAliveInterval = 20;
-    connect_options.cleansession = 1;
-    connect_options.will = &lwt_options;
-    if ((mqtt_rc = MQTTClient_connect(client, &connect_options)) != MQTTCLIENT_SUCCESS) {
-        fprintf(stderr, "connect error: %d\n", mqtt_rc);
-        app_return_code = EXIT_FAILURE;
-        goto destroy_exit;
+/**
+ * Read board temperature, in the decode worker with the stats file
+ * and once when the sensors are built.
+ * @param temperature Degrees Celsius.
+ * @return Zero on success, -1 when not available.
+ */
+static int read_temperature(double *temperature) {
+    int fd = open("/sys/class/hwmon/hwmon0/temp1_input", O_RDONLY);
+    if (fd == -1) {
+        return -1;
     }
-
-    // Add notification on stats file when connected to MQTT broker
-    // Create inotify instance
-    inotify_fd = inotify_init();
-    if (inotify_fd == -1) {
-        fprintf(stderr, "inotify_init error");
-        app_return_code = EXIT_FAILURE;
-        goto destroy_exit;
+    char buf[10] = {0};
+    float temp;
+    int rc = -1;
+    if (read(fd, buf, sizeof (buf) - 1) > 0 && sscanf(buf, "%f", &temp) == 1) {
+        *temperature = (double) (temp / 1000);
+        rc = 0;
     }
+    close(fd);
+    return rc;
+}
 
-    // Establish handler for "I/O possible" signal
-    struct sigaction sa;
-    sigemptyset(&sa.sa_mask);
-    sa.sa_flags = SA_RESTART;
-    sa.sa_handler = signal_io_handler;
-    if (sigaction(SIGIO, &sa, NULL) == -1) {
-        fprintf(stderr, "sigaction error");
-        app_return_code = EXIT_FAILURE;
-        goto destroy_exit;
-    }
+/**
+ * Read and decode stats.pb of a receiver into a free frame. Runs in the
+ * decode worker. Only last_1min is decoded here, other windows are decoded
+ * by the event loop from the frame when their interval is due.
+ * @param rx Receiver.
+ * @param notified_us Time the replacement was seen.
+ * @return 1 when a frame is ready, 0 otherwise.
+ */
+static int decode_stats(struct receiver *rx, uint64_t notified_us) {
+    struct stats_frame *fr = frame_acquire(rx);
+    uint64_t start = monotonic_us();
 
-    // Set owner process that is to receive IO signal
-    if (fcntl(inotify_fd, F_SETOWN, getpid()) == -1) {
-        fprintf(stderr, "F_SETOWN error");
-        app_return_code = EXIT_FAILURE;
-        goto destroy_exit;
+    if (fr == NULL) {
+        return 0;
     }
-
-    // Enable IO signaling and make I/O nonblocking for file descriptor
-    int flags = fcntl(inotify_fd, F_GETFL);
-    if (fcntl(inotify_fd, F_SETFL, flags | O_ASYNC | O_NONBLOCK) == -1) {
-        fprintf(stderr, "F_SETFL error");
-        app_return_code = EXIT_FAILURE;
-        goto destroy_exit;
+    struct pbfile_field *f = &fr->fields[STATS_FIELD_LAST_1MIN];
+    histogram_add(&metrics.wait, start - notified_us);
+    fr->notified_us = notified_us;
+    fr->last_1min = NULL;
+    pbfile_release(&fr->file);
+    arena_reset(&fr->arena);
+    fr->data = pbfile_read(&fr->file, rx->stats_path, &fr->len);
+    if (fr->data == NULL) {
+        atomic_fetch_add(&metrics.dropped, 1);
+        atomic_store(&fr->state, FRAME_FREE);
+        return 0;
     }
-
-    // Add notification watch to readsb stats file when closed after write.
-    // Notify also when stats.pb gets deleted (readsb stopped).
-    int inotify_wd = inotify_add_watch(inotify_fd, "/run/readsb/", IN_MOVED_TO | IN_DELETE);
-    if (inotify_wd == -1) {
-        fprintf(stderr, "inotify_add_watch error: readsb running? ");
-        app_return_code = EXIT_FAILURE;
-        goto destroy_exit;
+    uint64_t loaded = monotonic_us();
+    histogram_add(&metrics.read, loaded - start);
+    if (pbfile_scan(fr->data, fr->len, fr->fields, STATS_MAX_FIELD) == 0 && f->data) {
+        fr->last_1min = statistic_entry__unpack(&fr->arena.allocator, f->len, f->data);
     }
+    if (fr->last_1min == NULL) {
+        fprintf(stderr, "unpacking statistics message %s failed\n", rx->stats_path);
+        pbfile_release(&fr->file);
+        atomic_fetch_add(&metrics.dropped, 1);
+        atomic_store(&fr->state, FRAME_FREE);
+        return 0;
+    }
+    histogram_add(&metrics.decode, monotonic_us() - loaded);
+    fr->has_temperature = read_temperature(&fr->temperature) == 0;
+    atomic_store(&fr->state, FRAME_READY);
+    return 1;
+}
 
-    // Run this until we get a termination signal.
-    while (!app_exit && MQTTClient_isConnected(client)) {
-        MQTTClient_yield();
-        // Wait for new statistics
-        if (new_stats) {
-            new_stats = 0;
-            // Sensor config needs to be send frequently otherwise HASS will not recognize sensors after
-            // HASS server restart. (there is no connection loss since we are connected to MQTT broker)
-            for (int f = 0; statistics[f].name; ++f) {
-                // Create topic configuration
-                snprintf(topic, MAX_TOPIC_SIZE, MQTT_TOPIC_CONFIG, topic_prefix, client_id, statistics[f].id);
-                // Create json payload
-                len = snprintf(payload, MAX_PAYLOAD_SIZE, MQTT_SENSOR_CONFIG,
-                        client_id, // name part 1
-                        statistics[f].name, // name part 2
-                        client_id, // unique id part 1
-                        statistics[f].id, // unique id part 2
-                        topic_prefix, // state topic part 1
-                        client_id, // state topic part 2
-                        statistics[f].id, // value template name
-                        "mdi:airplane", // icon name
-                        statistics[f].unit // unit of measure
-                        );
-
-                pubmsg.payload = payload;
-                pubmsg.payloadlen = len;
-                pubmsg.qos = QOS;
-                pubmsg.retained = 0;
-                delivered_token = 0;
-                if ((mqtt_rc = MQTTClient_publishMessage(client, topic, &pubmsg, &token)) != MQTTCLIENT_SUCCESS) {
-                    fprintf(stderr, "publish stats config error: %d\n", mqtt_rc);
-                    app_return_code = EXIT_FAILURE;
-                } else {
-                    MQTTClient_waitForCompletion(client, delivered_token, 100);
-                }
-            }
+/**
+ * Decode worker thread. Waits for stats.pb replacements posted by the
+ * event loop, decodes them and wakes the event loop. File I/O and
+ * unpacking do not delay broker, timer and exporter events this way.
+ * While a decoded frame is not taken yet, replacements wait in the
+ * mailbox, so only the latest one is read once the event loop catches up.
+ * @param arg Not used.
+ * @return NULL.
+ */
+static void *decode_worker(void *arg) {
+    uint64_t count;
+    NOTUSED(arg);
 
-            // Create feeder status config
-            snprintf(topic, MAX_TOPIC_SIZE, MQTT_TOPIC_CONFIG, "homeassistant/binary_sensor", client_id, "running");
-            // Create json payload
-            len = snprintf(payload, MAX_PAYLOAD_SIZE, MQTT_STATUS_CONFIG,
-                    client_id, // name part 1
-                    client_id, // unique id part 1
-                    topic_prefix, // state topic part 1
-                    client_id // state topic part 2
-                    );
-
-            pubmsg.payload = payload;
-            pubmsg.payloadlen = len;
-            pubmsg.qos = QOS;
-            pubmsg.retained = 0;
-            delivered_token = 0;
-            if ((mqtt_rc = MQTTClient_publishMessage(client, topic, &pubmsg, &token)) != MQTTCLIENT_SUCCESS) {
-                fprintf(stderr, "publish status config error: %d\n", mqtt_rc);
-                app_return_code = EXIT_FAILURE;
-            } else {
-                MQTTClient_waitForCompletion(client, delivered_token, 100);
-            }
-
-            // Create properties topic
-            snprintf(topic, MAX_TOPIC_SIZE, MQTT_TOPIC_PROPERTIES, topic_prefix, client_id);
-            // Create properties json payload
-            char buf[100];
-            char *p = payload;
-            snprintf(payload, MAX_PAYLOAD_SIZE, "{\"%s\": \"%0.1lf\"", statistics[0].id, statistics[0].val);
-            for (int g = 1; statistics[g].name; ++g) {
-                snprintf(buf, 100, ", \"%s\": \"%0.1lf\"", statistics[g].id, statistics[g].val);
-                p = strcat(p, buf);
-            }
-            // Add feeder status
-            snprintf(buf, 100, ", \"running\": \"%u\"", feeder_status);
-            p = strcat(p, buf);
-            strcat(p, "}\0");
-
-            pubmsg.payload = payload;
-            pubmsg.payloadlen = (int) strlen(payload);
-            pubmsg.qos = QOS;
-            pubmsg.retained = 0;
-            delivered_token = 0;
-            if ((mqtt_rc = MQTTClient_publishMessage(client, topic, &pubmsg, &token)) != MQTTCLIENT_SUCCESS) {
-                fprintf(stderr, "publish properties error: %d\n", mqtt_rc);
-                app_return_code = EXIT_FAILURE;
-            } else {
-                MQTTClient_waitForCompletion(client, delivered_token, 100);
+    while (!atomic_load(&decode_exit)) {
+        if (read(decode_fd, &count, sizeof (count)) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "decode worker read error: %s\n", strerror(errno));
+            break;
+        }
+        int ready = 0;
+        for (int r = 0; r < num_receivers; ++r) {
+            struct receiver *rx = &receivers[r];
+            if (frame_ready(rx)) {
+                continue; // Woken again when taken
+            }
+            uint64_t notified_us = mailbox_take(&rx->stats_mailbox);
+            if (notified_us) {
+                ready |= decode_stats(rx, notified_us);
             }
         }
+        count = 1;
+        if (ready && write(decoded_fd, &count, sizeof (count)) == -1) {
+            fprintf(stderr, "decode worker write error: %s\n", strerror(errno));
+        }
     }
+    return NULL;
+}
 
-    // Publish client not running status on _expected_ disconnect
-    // Last will is send only on _unexpected_ disconnect.
-    if (MQTTClient_isConnected(client)) {
-        snprintf(topic, MAX_TOPIC_SIZE, MQTT_TOPIC_PROPERTIES, topic_prefix, client_id);
-        snprintf(payload, MAX_PAYLOAD_SIZE, "{\"running\": \"0\"}");
-        pubmsg.payload = payload;
-        pubmsg.payloadlen = (int) strlen(payload);
-        pubmsg.qos = QOS;
-        pubmsg.retained = 0;
-        delivered_token = 0;
-        if ((mqtt_rc = MQTTClient_publishMessage(client, topic, &pubmsg, &token)) != MQTTCLIENT_SUCCESS) {
-            fprintf(stderr, "publish disconnect error: %d\n", mqtt_rc);
-        } else {
-            MQTTClient_waitForCompletion(client, delivered_token, 100);
-        }
+/**
+ * Wake decode worker to look at the mailboxes.
+ */
+static void wake_decoder(void) {
+    uint64_t one = 1;
+    if (write(decode_fd, &one, sizeof (one)) == -1) {
+        fprintf(stderr, "decode request error: %s\n", strerror(errno));
     }
+}
 
-    if ((mqtt_rc = MQTTClient_disconnect(client, 1000)) != MQTTCLIENT_SUCCESS) {
-        fprintf(stderr, "disconnect error: %d\n", mqtt_rc);
-        app_return_code = EXIT_FAILURE;
+/**
+ * Post stats.pb replacement to the decode worker. A replacement still
+ * pending is superseded before it is read.
+ * @param rx Receiver.
+ */
+static void request_decode(struct receiver *rx) {
+    if (mailbox_post(&rx->stats_mailbox, monotonic_us())) {
+        atomic_fetch_add(&metrics.dropped, 1);
     }
+    wake_decoder();
+}
 
-destroy_exit:
-    MQTTClient_destroy(&client);
+/**
+ * Take the frame decoded last for the event loop. The decode worker skips
+ * a receiver while its frame is ready, so it is woken for replacements
+ * that arrived in the meantime.
+ * @param rx Receiver.
+ * @return Frame, NULL when none is ready.
+ */
+static struct stats_frame *frame_take(struct receiver *rx) {
+    for (int i = 0; i < 2; ++i) {
+        int state = FRAME_READY;
+        if (atomic_compare_exchange_strong(&rx->frames[i].state, &state, FRAME_HELD)) {
+            if (mailbox_pending(&rx->stats_mailbox)) {
+                wake_decoder();
+            }
+            return &rx->frames[i];
+        }
+    }
+    return NULL;
+}
 
-exit:
-    free(server_uri);
-    free(client_id);
-    free(topic_prefix);
-    if (inotify_fd && inotify_wd) {
-        inotify_rm_watch(inotify_fd, inotify_wd);
+/**
+ * Give held frame back to the decode worker once published.
+ * @param rx Receiver.
+ */
+static void frame_release(struct receiver *rx) {
+    if (rx->held == NULL) {
+        return;
     }
-    return app_return_code;
-}
\ No newline at end of file
+    // Windows point into the frame arena.
+    for (int w = 0; w < NUM_STATS_WINDOWS; ++w) {
+        rx->windows[w].msg = NULL;
+    }
+    atomic_store(&rx->held->state, FRAME_FREE);
+    rx->held = NULL;
+}
+
+/**
+ * Process stats.pb decoded by the worker. The frame is held until its
+ * windows are published.
+ * Only the windows needed are decoded, last_1min always and other windows
+ * when their publish interval is due.
+ * @param client MQTT client, for raw passthrough.
+ * @param rx Receiver.
+ * @param fr Frame taken with frame_take().
+ */
+static void update_from_stats(MQTTAsync client, struct receiver *rx, struct stats_frame *fr) {
+    struct pbfile_field *f;
+    StatisticEntry *last_1min = fr->last_1min;
+    time_t now = monotonic_seconds();
+
+    rx->held = fr;
+    if (raw_enabled) {
+        publish_raw(client, rx->topics.raw_stats_topic.str, fr->data, fr->len);
+    }
+    if (rx->polar && fr->fields[STATS_FIELD_POLAR_RANGE].data
+            && polar_decode(&rx->polar->current, fr->data, fr->len, STATS_FIELD_POLAR_RANGE) == 0) {
+        rx->polar->new = 1;
+    }
+    for (int w = 0; w < NUM_STATS_WINDOWS; ++w) {
+        struct window_state *ws = &rx->windows[w];
+        f = &fr->fields[stats_windows[w].field];
+        if (stats_windows[w].interval < 0 || f->data == NULL
+                || (ws->last_sent && now - ws->last_sent < stats_windows[w].interval)) {
+            continue;
+        }
+        // Interval restarts when published, see publish_windows().
+        ws->msg = stats_windows[w].field == STATS_FIELD_LAST_1MIN ? last_1min
+                : statistic_entry__unpack(&fr->arena.allocator, f->len, f->data);
+    }
+    if (rx->export_values) {
+        StatisticEntry *total = NULL;
+        f = &fr->fields[STATS_FIELD_TOTAL];
+        if (f->data) {
+            // Total is the last window, reuse it when it was decoded for publishing.
+            total = rx->windows[NUM_STATS_WINDOWS - 1].msg ? rx->windows[NUM_STATS_WINDOWS - 1].msg
+                    : statistic_entry__unpack(&fr->arena.allocator, f->len, f->data);
+        }
+        sensor_table_update(&export_sensors, &last_1min->base, rx->export_values);
+        rx->export_mask = 1u << EXPORT_LAST_1MIN;
+        if (total) {
+            sensor_table_update(&export_sensors, &total->base, rx->export_values + EXPORT_TOTAL * export_sensors.count);
+            rx->export_mask |= 1u << EXPORT_TOTAL;
+        }
+    }
+
+    if (last_1min->stop - rx->last_timestamp > 90) {
+        rx->feeder_status = 0;
+    } else {
+        rx->feeder_status = 1;
+    }
+    rx->last_timestamp = last_1min->stop;
+    rx->last_stats_time = now;
+    sensor_table_update(&sensors, &last_1min->base, rx->values);
+    if (fr->has_temperature && temperature_sensor != -1) {
+        rx->values[temperature_sensor] = fr->temperature;
+    }
+    metrics.updates++;
+}
+
+/**
+ * Find receiver of inotify watch.
+ * @param wd Watch descriptor.
+ * @return Receiver or NULL.
+ */
+static struct receiver *find_receiver(int wd) {
+    for (int r = 0; r < num_receivers; ++r) {
+        if (receivers[r].wd == wd) {
+            return &receivers[r];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Read and dispatch all pending inotify events.
+ * stats.pb is handed to the decode worker, aircraft.pb is decoded once
+ * per receiver after all pending events are read, the config file is
+ * reloaded after that.
+ */
+static void handle_inotify(void) {
+    char buf[BUF_LEN] __attribute__ ((aligned(8)));
+    ssize_t numRead;
+
+    while ((numRead = read(inotify_fd, buf, BUF_LEN)) > 0) {
+        /* Process all of the events in buffer returned by read() */
+        for (char *p = buf; p < buf + numRead;) {
+            struct inotify_event *event = (struct inotify_event *) p;
+            struct receiver *rx = find_receiver(event->wd);
+            p += sizeof (struct inotify_event) +event->len;
+            if (event->len == 0) {
+                continue;
+            }
+            // Config file written in place or replaced, applied once all events are read
+            if (event->wd == config_wd && (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+                    && strcmp(event->name, config_name) == 0) {
+                config_pending = 1;
+            }
+            if (rx == NULL) {
+                continue;
+            }
+            if (strcmp(event->name, READSB_STATS_FILE_PB) == 0) {
+                // We got a new stats.pb from temp file
+                if (event->mask & IN_MOVED_TO) {
+                    request_decode(rx);
+                }
+                // stats.pb deleted, readsb stopped?
+                if (event->mask & IN_DELETE) {
+                    fprintf(stderr, "error %s deleted. readsb stopped?\n", rx->stats_path);
+                    if (num_receivers == 1) {
+                        app_exit = 1;
+                        app_return_code = EXIT_FAILURE;
+                    } else {
+                        // Other receivers keep running.
+                        rx->feeder_status = 0;
+                        rx->publish_pending = 1;
+                    }
+                }
+            } else if ((aircraft_enabled || raw_enabled) && strcmp(event->name, READSB_AIRCRAFT_FILE_PB) == 0
+                    && (event->mask & IN_MOVED_TO)) {
+                mailbox_post(&rx->aircraft_mailbox, monotonic_us());
+            }
+        }
+    }
+    if (numRead == -1 && errno != EAGAIN) {
+        fprintf(stderr, "inotify read error: %s\n", strerror(errno));
+    }
+}
+
+/**
+ * Read pending signal from signalfd and request shutdown.
+ * @param signal_fd Signal file descriptor.
+ */
+static void handle_signal(int signal_fd) {
+    struct signalfd_siginfo si;
+    if (read(signal_fd, &si, sizeof (si)) != sizeof (si)) {
+        return;
+    }
+    app_exit = 1;
+    app_return_code = EXIT_SUCCESS;
+    fprintf(stderr, "caught signal %s, shutting down..\n", strsignal((int) si.ssi_signo));
+}
+
+/**
+ * Periodic timer work: check broker connection and stats staleness.
+ * Receivers whose feeder status changed get their properties published.
+ * @param timer_fd Timer file descriptor.
+ * @param client MQTT client.
+ */
+static void handle_timer(int timer_fd, MQTTAsync client) {
+    uint64_t expirations;
+    if (read(timer_fd, &expirations, sizeof (expirations)) != sizeof (expirations)) {
+        return;
+    }
+    if (broker_state == BROKER_CONNECTED && !MQTTAsync_isConnected(client)) {
+        fprintf(stderr, "not connected to broker\n");
+        atomic_store(&link_lost, 1);
+        broker_notify();
+    }
+    if (exporter_addr) {
+        exporter_expire(&exporter);
+    }
+    // No stats.pb from readsb for too long, report feeder not running.
+    time_t now = monotonic_seconds();
+    for (int r = 0; r < num_receivers; ++r) {
+        struct receiver *rx = &receivers[r];
+        if (rx->feeder_status && now - rx->last_stats_time > STATS_STALE_TIMEOUT) {
+            fprintf(stderr, "no statistics update in %s for %d seconds. readsb stalled?\n", rx->dir, STATS_STALE_TIMEOUT);
+            rx->feeder_status = 0;
+            rx->publish_pending = 1;
+        }
+    }
+}
+
+/**
+ * Add file descriptor to epoll instance.
+ * @param epoll_fd Epoll instance.
+ * @param fd File descriptor to watch for input.
+ * @param source Event source identifier.
+ * @return Zero on success, -1 on error.
+ */
+static int epoll_add(int epoll_fd, int fd, uint32_t source) {
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN;
+    ev.data.u32 = source;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/**
+ * Build HASS discovery config payload for one sensor.
+ * @param json Writer.
+ * @param rx Receiver.
+ * @param f Index into sensor table.
+ */
+static void build_sensor_config(struct json *json, const struct receiver *rx, int f) {
+    json_object_begin(json);
+    json_key(json, "name");
+    json_string_begin(json);
+    json_string_append(json, rx->client_id);
+    json_string_append(json, " ");
+    json_string_append(json, sensors.entry[f].name);
+    json_string_end(json);
+    json_key(json, "unique_id");
+    json_string_begin(json);
+    json_string_append(json, rx->client_id);
+    json_string_append(json, ".");
+    json_string_append(json, sensors.entry[f].id);
+    json_string_end(json);
+    json_member_string(json, "state_topic", rx->topics.properties_topic.str);
+    json_member_string(json, "availability_topic", availability_topic.str);
+    json_key(json, "val_tpl");
+    json_string_begin(json);
+    // Properties carry changed sensors only, keep state of missing ones.
+    json_string_append(json, "{{value_json.");
+    json_string_append(json, sensors.entry[f].id);
+    json_string_append(json, "|default(this.state)}}");
+    json_string_end(json);
+    json_member_string(json, "icon", MQTT_SENSOR_ICON);
+    json_member_string(json, "platform", "mqtt");
+    if (sensors.entry[f].unit) {
+        json_member_string(json, "unit_of_measurement", sensors.entry[f].unit);
+    }
+    json_object_end(json);
+}
+
+/**
+ * Build HASS discovery config payload for feeder status binary sensor.
+ * @param json Writer.
+ * @param rx Receiver.
+ */
+static void build_status_config(struct json *json, const struct receiver *rx) {
+    json_object_begin(json);
+    json_key(json, "name");
+    json_string_begin(json);
+    json_string_append(json, rx->client_id);
+    json_string_append(json, " Status");
+    json_string_end(json);
+    json_key(json, "unique_id");
+    json_string_begin(json);
+    json_string_append(json, rx->client_id);
+    json_string_append(json, ".running");
+    json_string_end(json);
+    json_member_string(json, "device_class", "running");
+    json_member_string(json, "state_topic", rx->topics.properties_topic.str);
+    json_member_string(json, "availability_topic", availability_topic.str);
+    json_member_string(json, "val_tpl", "{{value_json.running}}");
+    json_member_string(json, "payload_on", "1");
+    json_member_string(json, "payload_off", "0");
+    json_member_string(json, "platform", "mqtt");
+    json_object_end(json);
+}
+
+/**
+ * Format sensor value with the decimals of the sensor.
+ * @param buf Buffer of FMT_BUF_SIZE.
+ * @param s Sensor.
+ * @param val Value.
+ * @return Length of formatted value.
+ */
+static size_t format_value(char *buf, const struct sensor *s, double val) {
+    if (s->decimals) {
+        return fmt_fixed(buf, val, s->decimals);
+    }
+    return fmt_i64(buf, (int64_t) val);
+}
+
+/**
+ * Build properties payload with changed sensor values and feeder status.
+ * A sensor is included when it moved beyond its deadband since last
+ * published, or was not published for the heartbeat interval. Included
+ * sensors are marked pending, they count as sent once committed.
+ * @param json Writer.
+ * @param rx Receiver.
+ * @param full Include all sensors.
+ * @return Number of included sensors, feeder status counts when changed.
+ */
+static int build_properties(struct json *json, struct receiver *rx, int full) {
+    char buf[FMT_BUF_SIZE];
+    size_t len;
+    int count = 0;
+    time_t now = monotonic_seconds();
+
+    json_object_begin(json);
+    for (int f = 0; f < topics.num_sensors; ++f) {
+        struct sensor_state *st = &rx->sensor_states[f];
+        double val = rx->values[f];
+        double diff = val > st->sent ? val - st->sent : st->sent - val;
+        double deadband = st->rel_deadband * (st->sent < 0 ? -st->sent : st->sent);
+        if (deadband < st->abs_deadband) {
+            deadband = st->abs_deadband;
+        }
+        if (!full && st->sent_time && diff <= deadband
+                && !(heartbeat_interval > 0 && now - st->sent_time >= heartbeat_interval)) {
+            continue;
+        }
+        st->pending = 1;
+        count++;
+        len = format_value(buf, &sensors.entry[f], val);
+        json_key_raw(json, topics.sensor_keys[f].str, (size_t) topics.sensor_keys[f].len);
+        json_string_raw(json, buf, len);
+    }
+    if (rx->feeder_status != rx->running_sent) {
+        count++;
+    }
+    json_member_string(json, "running", rx->feeder_status ? "1" : "0");
+    json_object_end(json);
+    return count;
+}
+
+/**
+ * Build payload of a statistics window with all sensors read from the message.
+ * @param json Writer.
+ * @param msg Decoded window.
+ */
+static void build_window(struct json *json, const StatisticEntry *msg) {
+    char buf[FMT_BUF_SIZE];
+    size_t len;
+
+    json_object_begin(json);
+    json_key(json, "start");
+    json_raw(json, buf, fmt_u64(buf, msg->start));
+    json_key(json, "stop");
+    json_raw(json, buf, fmt_u64(buf, msg->stop));
+    for (int f = 0; f < topics.num_sensors; ++f) {
+        const struct sensor *s = &sensors.entry[f];
+        if (s->kind == SENSOR_EXTERNAL) {
+            continue;
+        }
+        len = format_value(buf, s, sensor_read(s, &msg->base));
+        json_key_raw(json, topics.sensor_keys[f].str, (size_t) topics.sensor_keys[f].len);
+        json_string_raw(json, buf, len);
+    }
+    json_object_end(json);
+}
+
+/**
+ * Build properties payload announcing feeder not running.
+ * Used as last will and on expected disconnect.
+ * @param json Writer.
+ */
+static void build_offline(struct json *json) {
+    json_object_begin(json);
+    json_member_string(json, "running", "0");
+    json_object_end(json);
+}
+
+/**
+ * Copy string into interned table entry.
+ * @param dst Table entry.
+ * @param src String.
+ * @param len String length.
+ * @return Zero on success, -1 when out of memory.
+ */
+static int intern(struct interned *dst, const char *src, size_t len) {
+    dst->str = malloc(len + 1);
+    if (dst->str == NULL) {
+        return -1;
+    }
+    memcpy(dst->str, src, len);
+    dst->str[len] = '\0';
+    dst->len = (int) len;
+    return 0;
+}
+
+/**
+ * Format topic into interned table entry.
+ * @param dst Table entry.
+ * @param format Topic format.
+ * @return Zero on success, -1 when out of memory or topic too long.
+ */
+static int intern_topic(struct interned *dst, const char *format, ...) {
+    char topic[MAX_TOPIC_SIZE];
+    va_list ap;
+    va_start(ap, format);
+    int len = vsnprintf(topic, MAX_TOPIC_SIZE, format, ap);
+    va_end(ap);
+    if (len < 0 || len >= MAX_TOPIC_SIZE) {
+        fprintf(stderr, "topic %s exceeds %d characters\n", topic, MAX_TOPIC_SIZE - 1);
+        return -1;
+    }
+    return intern(dst, topic, (size_t) len);
+}
+
+/**
+ * Finish payload and copy it into interned table entry.
+ * @param dst Table entry.
+ * @param json Writer holding the payload.
+ * @return Zero on success, -1 when out of memory or payload too long.
+ */
+static int intern_json(struct interned *dst, struct json *json) {
+    size_t len;
+    if (json_finish(json, &len) == -1) {
+        fprintf(stderr, "payload exceeds %zu bytes\n", json->size);
+        return -1;
+    }
+    return intern(dst, json->buf, len);
+}
+
+/**
+ * Build sensor table from export and exclude settings.
+ * @return Zero on success, -1 on error.
+ */
+static int build_sensors(void) {
+    static char temperature_field[] = "temperatur";
+    char *external[] = {temperature_field};
+    double temperature;
+
+    // Without a readable sensor it is neither announced nor published as 0
+    if (sensor_table_init(&sensors, &statistic_entry__descriptor, sensor_meta, external,
+            read_temperature(&temperature) == 0, export_args, num_exports, exclude_args, num_excludes) == -1) {
+        return -1;
+    }
+    temperature_sensor = sensor_table_find(&sensors, temperature_field, strlen(temperature_field));
+    return 0;
+}
+
+/**
+ * Build shared strings and payloads from options.
+ * @return Zero on success, -1 on error.
+ */
+static int build_topics(void) {
+    struct json json;
+    int n = sensors.count;
+
+    topics.sensor_keys = calloc((size_t) n, sizeof (struct interned));
+    if (topics.sensor_keys == NULL) {
+        return -1;
+    }
+    topics.num_sensors = n;
+    for (int f = 0; f < n; ++f) {
+        json_init(&json, payload, MAX_PAYLOAD_SIZE);
+        json_key(&json, sensors.entry[f].id);
+        if (intern_json(&topics.sensor_keys[f], &json) == -1) {
+            return -1;
+        }
+    }
+    if (intern_topic(&topics.diagnostics_topic, MQTT_TOPIC_DIAGNOSTICS, topic_prefix, client_id) == -1) {
+        return -1;
+    }
+    json_init(&json, payload, MAX_PAYLOAD_SIZE);
+    build_offline(&json);
+    return intern_json(&topics.offline, &json);
+}
+
+/**
+ * Build topics and discovery payloads of a receiver.
+ * @param rx Receiver.
+ * @return Zero on success, -1 on error.
+ */
+static int build_receiver_topics(struct receiver *rx) {
+    struct receiver_topics *t = &rx->topics;
+    const char *id = rx->client_id;
+    struct json json;
+
+    if (intern_topic(&t->properties_topic, MQTT_TOPIC_PROPERTIES, topic_prefix, id) == -1
+            || intern_topic(&t->status_config_topic, MQTT_TOPIC_CONFIG, "homeassistant/binary_sensor", id, "running") == -1
+            || intern_topic(&t->aircraft_topic, MQTT_TOPIC_AIRCRAFT, topic_prefix, id) == -1
+            || intern_topic(&t->aircraft_stats_topic, MQTT_TOPIC_AIRCRAFT_STATS, topic_prefix, id) == -1
+            || intern_topic(&t->polar_topic, MQTT_TOPIC_POLAR, topic_prefix, id) == -1
+            || intern_topic(&t->polar_max_topic, MQTT_TOPIC_POLAR_MAX, topic_prefix, id) == -1
+            || intern_topic(&t->raw_stats_topic, MQTT_TOPIC_RAW, topic_prefix, id, "stats") == -1
+            || intern_topic(&t->raw_aircraft_topic, MQTT_TOPIC_RAW, topic_prefix, id, "aircraft") == -1) {
+        return -1;
+    }
+    for (int w = 0; w < NUM_STATS_WINDOWS; ++w) {
+        if (stats_windows[w].interval >= 0
+                && intern_topic(&t->window_topics[w], MQTT_TOPIC_WINDOW, topic_prefix, id, stats_windows[w].name) == -1) {
+            return -1;
+        }
+    }
+
+    // Discovery payloads are sent again on each HASS birth and reconnect.
+    t->config_topics = calloc((size_t) sensors.count, sizeof (struct interned));
+    t->configs = calloc((size_t) sensors.count, sizeof (struct interned));
+    if (t->config_topics == NULL || t->configs == NULL) {
+        return -1;
+    }
+    t->num_configs = sensors.count;
+    for (int f = 0; f < sensors.count; ++f) {
+        json_init(&json, payload, MAX_PAYLOAD_SIZE);
+        build_sensor_config(&json, rx, f);
+        if (intern_topic(&t->config_topics[f], MQTT_TOPIC_CONFIG, topic_prefix, id, sensors.entry[f].id) == -1
+                || intern_json(&t->configs[f], &json) == -1) {
+            return -1;
+        }
+    }
+    json_init(&json, payload, MAX_PAYLOAD_SIZE);
+    build_status_config(&json, rx);
+    return intern_json(&t->status_config, &json);
+}
+
+/**
+ * Apply deadband options to sensor states.
+ * Options have the form <id>=<abs>[:<rel%>], id * sets all sensors.
+ * @param states Sensor states, index matches sensor table.
+ * @return Zero on success, -1 on invalid option.
+ */
+static int init_sensor_states(struct sensor_state *states) {
+    for (int d = 0; d < num_deadbands; ++d) {
+        char *arg = deadband_args[d];
+        char *eq = strchr(arg, '=');
+        char *end;
+        if (eq == NULL) {
+            fprintf(stderr, "invalid deadband %s\n", arg);
+            return -1;
+        }
+        double abs_deadband = strtod(eq + 1, &end);
+        double rel_deadband = 0;
+        if (*end == ':') {
+            rel_deadband = strtod(end + 1, &end) / 100;
+        }
+        if (*end != '\0' || abs_deadband < 0 || rel_deadband < 0) {
+            fprintf(stderr, "invalid deadband %s\n", arg);
+            return -1;
+        }
+        size_t id_len = (size_t) (eq - arg);
+        if (id_len == 1 && arg[0] == '*') {
+            for (int f = 0; f < topics.num_sensors; ++f) {
+                states[f].abs_deadband = abs_deadband;
+                states[f].rel_deadband = rel_deadband;
+            }
+            continue;
+        }
+        int f = sensor_table_find(&sensors, arg, id_len);
+        if (f == -1) {
+            fprintf(stderr, "unknown sensor in deadband %s\n", arg);
+            return -1;
+        }
+        states[f].abs_deadband = abs_deadband;
+        states[f].rel_deadband = rel_deadband;
+    }
+    return 0;
+}
+
+/**
+ * Allocate values and sensor states of a receiver for the current sensor
+ * table. Sensors also in the previous table keep their value and last
+ * published state, so a reload does not republish all of them.
+ * @param rx Receiver.
+ * @param old Previous sensor table.
+ * @param old_values Values indexed by previous table.
+ * @param old_states Sensor states indexed by previous table.
+ * @return Zero on success, -1 on error.
+ */
+static int remap_sensor_states(struct receiver *rx, const struct sensor_table *old,
+        const double *old_values, const struct sensor_state *old_states) {
+    rx->values = calloc((size_t) topics.num_sensors, sizeof (double));
+    rx->sensor_states = calloc((size_t) topics.num_sensors, sizeof (struct sensor_state));
+    if (rx->values == NULL || rx->sensor_states == NULL) {
+        return -1;
+    }
+    for (int f = 0; f < topics.num_sensors; ++f) {
+        int o = sensor_table_find(old, sensors.entry[f].id, strlen(sensors.entry[f].id));
+        if (o != -1) {
+            rx->values[f] = old_values[o];
+            rx->sensor_states[f].sent = old_states[o].sent;
+            rx->sensor_states[f].sent_time = old_states[o].sent_time;
+        }
+    }
+    return init_sensor_states(rx->sensor_states);
+}
+
+/**
+ * Format string into newly allocated memory.
+ * @param format String format.
+ * @return String or NULL when out of memory.
+ */
+static char *format_string(const char *format, ...) {
+    char *str = NULL;
+    va_list ap, ap2;
+    va_start(ap, format);
+    va_copy(ap2, ap);
+    int len = vsnprintf(NULL, 0, format, ap);
+    if (len >= 0 && (str = malloc((size_t) len + 1)) != NULL) {
+        vsnprintf(str, (size_t) len + 1, format, ap2);
+    }
+    va_end(ap2);
+    va_end(ap);
+    return str;
+}
+
+/**
+ * Set up a receiver from its option.
+ * @param rx Receiver.
+ * @param arg Option <dir>[=<clientid>], NULL for the default directory.
+ * @param first First receiver, keeps the all-time polar range file name as given.
+ * @return Zero on success, -1 on error.
+ */
+static int init_receiver(struct receiver *rx, const char *arg, int first) {
+    const char *eq = arg ? strchr(arg, '=') : NULL;
+
+    rx->wd = -1;
+    rx->running_sent = -1;
+    rx->snapshot_pending = 1;
+    rx->dir = arg ? strndup(arg, eq ? (size_t) (eq - arg) : strlen(arg)) : strdup(READSB_DIR);
+    rx->client_id = strndup(eq ? eq + 1 : client_id, MAX_ID_SIZE);
+    if (rx->dir == NULL || rx->client_id == NULL) {
+        return -1;
+    }
+    for (struct receiver *other = receivers; other < rx; ++other) {
+        if (strcmp(other->client_id, rx->client_id) == 0) {
+            fprintf(stderr, "receiver %s needs a client id other than %s\n", rx->dir, rx->client_id);
+            return -1;
+        }
+    }
+    rx->stats_path = format_string("%s/%s", rx->dir, READSB_STATS_FILE_PB);
+    rx->aircraft_path = format_string("%s/%s", rx->dir, READSB_AIRCRAFT_FILE_PB);
+    rx->values = calloc((size_t) topics.num_sensors, sizeof (double));
+    if (exporter_addr) {
+        rx->export_values = calloc((size_t) (NUM_EXPORT_WINDOWS * export_sensors.count), sizeof (double));
+        if (rx->export_values == NULL) {
+            return -1;
+        }
+    }
+    rx->sensor_states = calloc((size_t) topics.num_sensors, sizeof (struct sensor_state));
+    if (arena_init(&rx->frames[0].arena, STATS_ARENA_SIZE) == -1 || arena_init(&rx->frames[1].arena, STATS_ARENA_SIZE) == -1) {
+        return -1;
+    }
+    if (rx->stats_path == NULL || rx->aircraft_path == NULL || rx->values == NULL || rx->sensor_states == NULL
+            || build_receiver_topics(rx) == -1 || init_sensor_states(rx->sensor_states) == -1) {
+        return -1;
+    }
+    if (polar_enabled) {
+        rx->polar = calloc(1, sizeof (struct polar_state));
+        if (rx->polar == NULL) {
+            return -1;
+        }
+        rx->polar->full_pending = 1;
+        rx->polar->max_pending = 1;
+        if (polar_max_file) {
+            rx->polar->max_file = first ? strdup(polar_max_file) : format_string("%s.%s", polar_max_file, rx->client_id);
+            if (rx->polar->max_file == NULL || polar_load(&rx->polar->max, rx->polar->max_file) == -1) {
+                return -1;
+            }
+        }
+    }
+    if (aircraft_enabled && aircraft_tracker_init(&rx->aircraft_tracker) == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Free topics of a receiver.
+ * @param t Receiver topics.
+ */
+static void free_receiver_topics(struct receiver_topics *t) {
+    for (int f = 0; f < t->num_configs; ++f) {
+        free(t->config_topics[f].str);
+        free(t->configs[f].str);
+    }
+    free(t->config_topics);
+    free(t->configs);
+    free(t->properties_topic.str);
+    free(t->status_config_topic.str);
+    free(t->status_config.str);
+    free(t->aircraft_topic.str);
+    free(t->aircraft_stats_topic.str);
+    free(t->raw_stats_topic.str);
+    free(t->raw_aircraft_topic.str);
+    free(t->polar_topic.str);
+    free(t->polar_max_topic.str);
+    for (int w = 0; w < NUM_STATS_WINDOWS; ++w) {
+        free(t->window_topics[w].str);
+    }
+    memset(t, 0, sizeof (*t));
+}
+
+/**
+ * Free receiver resources.
+ * @param rx Receiver.
+ */
+static void free_receiver(struct receiver *rx) {
+    free_receiver_topics(&rx->topics);
+    if (rx->polar) {
+        free(rx->polar->max_file);
+        free(rx->polar);
+    }
+    aircraft_tracker_destroy(&rx->aircraft_tracker);
+    for (int i = 0; i < 2; ++i) {
+        arena_destroy(&rx->frames[i].arena);
+        pbfile_destroy(&rx->frames[i].file);
+    }
+    free(rx->values);
+    free(rx->export_values);
+    free(rx->sensor_states);
+    free(rx->stats_path);
+    free(rx->aircraft_path);
+    free(rx->dir);
+    free(rx->client_id);
+    memset(rx, 0, sizeof (*rx));
+}
+
+/**
+ * Free shared strings and payloads.
+ * @param t Topic table.
+ */
+static void free_topics(struct topic_table *t) {
+    for (int f = 0; f < t->num_sensors; ++f) {
+        free(t->sensor_keys[f].str);
+    }
+    free(t->sensor_keys);
+    free(t->offline.str);
+    free(t->diagnostics_topic.str);
+    memset(t, 0, sizeof (*t));
+}
+
+/**
+ * Copy string, NULL stays NULL.
+ * @return Zero on success, -1 when out of memory.
+ */
+static int copy_string(char **dst, const char *src) {
+    *dst = NULL;
+    return src && (*dst = strdup(src)) == NULL ? -1 : 0;
+}
+
+/**
+ * Copy list of strings.
+ * @param dst Destination list.
+ * @param num Returns number of strings copied.
+ * @return Zero on success, -1 when out of memory.
+ */
+static int copy_list(char **dst, int *num, char *const *src, int num_src) {
+    for (*num = 0; *num < num_src; ++*num) {
+        if ((dst[*num] = strdup(src[*num])) == NULL) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Free strings of settings.
+ * @param s Settings.
+ */
+static void settings_free(struct settings *s) {
+    free(s->username);
+    free(s->password);
+    free(s->topic_prefix);
+    free(s->hass_status_topic);
+    for (int i = 0; i < s->num_deadbands; ++i) {
+        free(s->deadband_args[i]);
+    }
+    for (int i = 0; i < s->num_exports; ++i) {
+        free(s->export_args[i]);
+    }
+    for (int i = 0; i < s->num_excludes; ++i) {
+        free(s->exclude_args[i]);
+    }
+    memset(s, 0, sizeof (*s));
+}
+
+/**
+ * Deep copy settings.
+ * @param dst Destination, free with settings_free() also on error.
+ * @param src Source.
+ * @return Zero on success, -1 when out of memory.
+ */
+static int settings_copy(struct settings *dst, const struct settings *src) {
+    memset(dst, 0, sizeof (*dst));
+    dst->heartbeat_interval = src->heartbeat_interval;
+    dst->snapshot_interval = src->snapshot_interval;
+    dst->diagnostics_interval = src->diagnostics_interval;
+    memcpy(dst->window_intervals, src->window_intervals, sizeof (dst->window_intervals));
+    if (copy_string(&dst->username, src->username) == -1
+            || copy_string(&dst->password, src->password) == -1
+            || copy_string(&dst->topic_prefix, src->topic_prefix) == -1
+            || copy_string(&dst->hass_status_topic, src->hass_status_topic) == -1
+            || copy_list(dst->deadband_args, &dst->num_deadbands, src->deadband_args, src->num_deadbands) == -1
+            || copy_list(dst->export_args, &dst->num_exports, src->export_args, src->num_exports) == -1
+            || copy_list(dst->exclude_args, &dst->num_excludes, src->exclude_args, src->num_excludes) == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Take settings given on the command line. Strings allocated by option
+ * parsing are owned by the settings from here on.
+ * @param s Settings.
+ * @return Zero on success, -1 when out of memory.
+ */
+static int settings_capture(struct settings *s) {
+    memset(s, 0, sizeof (*s));
+    s->username = (char *) connect_options.username;
+    s->password = (char *) connect_options.password;
+    s->topic_prefix = topic_prefix;
+    s->hass_status_topic = hass_status_topic;
+    s->heartbeat_interval = heartbeat_interval;
+    s->snapshot_interval = snapshot_interval;
+    s->diagnostics_interval = diagnostics_interval;
+    for (int w = 0; w < NUM_STATS_WINDOWS; ++w) {
+        s->window_intervals[w] = stats_windows[w].interval;
+    }
+    if (copy_list(s->deadband_args, &s->num_deadbands, deadband_args, num_deadbands) == -1
+            || copy_list(s->export_args, &s->num_exports, export_args, num_exports) == -1
+            || copy_list(s->exclude_args, &s->num_excludes, exclude_args, num_excludes) == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Point globals at settings. The settings must outlive their use.
+ * @param s Settings.
+ */
+static void use_settings(const struct settings *s) {
+    connect_options.username = s->username;
+    connect_options.password = s->password;
+    topic_prefix = s->topic_prefix;
+    pthread_mutex_lock(&hass_status_lock);
+    hass_status_topic = s->hass_status_topic;
+    pthread_mutex_unlock(&hass_status_lock);
+    heartbeat_interval = s->heartbeat_interval;
+    snapshot_interval = s->snapshot_interval;
+    diagnostics_interval = s->diagnostics_interval;
+    for (int w = 0; w < NUM_STATS_WINDOWS; ++w) {
+        stats_windows[w].interval = s->window_intervals[w];
+    }
+    memcpy(deadband_args, s->deadband_args, sizeof (deadband_args));
+    num_deadbands = s->num_deadbands;
+    memcpy(export_args, s->export_args, sizeof (export_args));
+    num_exports = s->num_exports;
+    memcpy(exclude_args, s->exclude_args, sizeof (exclude_args));
+    num_excludes = s->num_excludes;
+}
+
+static int string_changed(const char *a, const char *b) {
+    return (a == NULL) != (b == NULL) || (a && strcmp(a, b) != 0);
+}
+
+static int list_changed(char *const *a, int num_a, char *const *b, int num_b) {
+    if (num_a != num_b) {
+        return 1;
+    }
+    for (int i = 0; i < num_a; ++i) {
+        if (strcmp(a[i], b[i]) != 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Compare settings.
+ * @return Mask of CHANGED_* flags, zero when equal.
+ */
+static int settings_changes(const struct settings *a, const struct settings *b) {
+    int changed = 0;
+
+    if (string_changed(a->username, b->username) || string_changed(a->password, b->password)) {
+        changed |= CHANGED_CREDENTIALS;
+    }
+    if (string_changed(a->topic_prefix, b->topic_prefix)) {
+        changed |= CHANGED_PREFIX;
+    }
+    if (string_changed(a->hass_status_topic, b->hass_status_topic)) {
+        changed |= CHANGED_HASS_STATUS;
+    }
+    if (list_changed(a->export_args, a->num_exports, b->export_args, b->num_exports)
+            || list_changed(a->exclude_args, a->num_excludes, b->exclude_args, b->num_excludes)) {
+        changed |= CHANGED_SENSORS;
+    }
+    if (list_changed(a->deadband_args, a->num_deadbands, b->deadband_args, b->num_deadbands)) {
+        changed |= CHANGED_DEADBANDS;
+    }
+    if (memcmp(a->window_intervals, b->window_intervals, sizeof (a->window_intervals)) != 0) {
+        changed |= CHANGED_WINDOWS;
+    }
+    if (a->heartbeat_interval != b->heartbeat_interval || a->snapshot_interval != b->snapshot_interval
+            || a->diagnostics_interval != b->diagnostics_interval) {
+        changed |= CHANGED_INTERVALS;
+    }
+    return changed;
+}
+
+/**
+ * Replace string setting.
+ * @return Zero on success, -1 when out of memory.
+ */
+static int set_string(char **dst, const char *value) {
+    free(*dst);
+    return copy_string(dst, value);
+}
+
+/**
+ * Add entry to list setting. The first entry from the config file drops
+ * the entries given on the command line.
+ * @return Zero on success, -1 when the list is full or out of memory.
+ */
+static int add_list(char **list, int *num, int max, int *replaced, const char *value) {
+    if (!*replaced) {
+        for (int i = 0; i < *num; ++i) {
+            free(list[i]);
+        }
+        *num = 0;
+        *replaced = 1;
+    }
+    if (*num == max || (list[*num] = strdup(value)) == NULL) {
+        return -1;
+    }
+    (*num)++;
+    return 0;
+}
+
+/**
+ * Parse interval setting in seconds.
+ * @return Zero on success, -1 when not a number.
+ */
+static int parse_seconds(const char *value, int *seconds) {
+    char *end;
+    long n = strtol(value, &end, 10);
+    if (end == value || *end != '\0' || n < INT_MIN || n > INT_MAX) {
+        return -1;
+    }
+    *seconds = (int) n;
+    return 0;
+}
+
+/**
+ * Apply one config file setting, see config_parse().
+ * @param ctx Settings being loaded.
+ * @return Zero on success, -1 on invalid setting.
+ */
+static int config_entry(void *ctx, const char *key, const char *value, int line) {
+    struct config_load *load = ctx;
+    struct settings *s = load->settings;
+    int w, interval, rc = 0;
+
+    if (strcmp(key, "user") == 0) {
+        rc = set_string(&s->username, *value ? value : NULL);
+    } else if (strcmp(key, "pass") == 0) {
+        rc = set_string(&s->password, *value ? value : NULL);
+    } else if (strcmp(key, "topic") == 0 || strcmp(key, "hass-status") == 0) {
+        if (*value == '\0' || strlen(value) >= MAX_TOPIC_SIZE) {
+            fprintf(stderr, "config %s:%d: invalid topic for %s\n", config_path, line, key);
+            return -1;
+        }
+        rc = set_string(key[0] == 't' ? &s->topic_prefix : &s->hass_status_topic, value);
+    } else if (strcmp(key, "heartbeat") == 0 || strcmp(key, "snapshot") == 0 || strcmp(key, "diagnostics") == 0) {
+        int *interval = key[0] == 'h' ? &s->heartbeat_interval
+                : key[0] == 's' ? &s->snapshot_interval : &s->diagnostics_interval;
+        if (parse_seconds(value, interval) == -1) {
+            fprintf(stderr, "config %s:%d: invalid %s interval %s\n", config_path, line, key, value);
+            return -1;
+        }
+    } else if (strcmp(key, "window") == 0) {
+        if (parse_window(value, &w, &interval) == -1) {
+            fprintf(stderr, "config %s:%d: invalid statistics window %s\n", config_path, line, value);
+            return -1;
+        }
+        // Like the lists, windows in the file replace all of the command line.
+        if (!load->windows) {
+            for (int i = 0; i < NUM_STATS_WINDOWS; ++i) {
+                s->window_intervals[i] = -1;
+            }
+            load->windows = 1;
+        }
+        s->window_intervals[w] = interval;
+    } else if (strcmp(key, "deadband") == 0) {
+        rc = add_list(s->deadband_args, &s->num_deadbands, MAX_DEADBANDS, &load->deadbands, value);
+    } else if (strcmp(key, "export") == 0) {
+        rc = add_list(s->export_args, &s->num_exports, MAX_FIELD_ARGS, &load->exports, value);
+    } else if (strcmp(key, "exclude") == 0) {
+        rc = add_list(s->exclude_args, &s->num_excludes, MAX_FIELD_ARGS, &load->excludes, value);
+    } else {
+        for (const struct argp_option *o = options; o->name; ++o) {
+            if (strcmp(key, o->name) == 0) {
+                fprintf(stderr, "config %s:%d: %s can be set on the command line only\n", config_path, line, key);
+                return -1;
+            }
+        }
+        fprintf(stderr, "config %s:%d: unknown setting %s\n", config_path, line, key);
+        return -1;
+    }
+    if (rc == -1) {
+        fprintf(stderr, "config %s:%d: %s not set, too many entries or out of memory\n", config_path, line, key);
+    }
+    return rc;
+}
+
+/**
+ * Load settings: command line settings, overridden by the config file.
+ * @param s Returns settings, free with settings_free().
+ * @return Zero on success, -1 on error, s is empty then.
+ */
+static int load_settings(struct settings *s) {
+    struct config_load load = {.settings = s};
+
+    if (settings_copy(s, &base_settings) == -1) {
+        fprintf(stderr, "unable to copy settings: out of memory\n");
+        settings_free(s);
+        return -1;
+    }
+    if (config_path && config_parse(config_path, config_entry, &load) == -1) {
+        settings_free(s);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Publish HASS discovery configuration of one sensor of a receiver.
+ * @param client MQTT client.
+ * @param rx Receiver.
+ * @param f Index into sensor table.
+ */
+static void publish_sensor_config(MQTTAsync client, const struct receiver *rx, int f) {
+    const struct receiver_topics *t = &rx->topics;
+    if (publish(client, t->config_topics[f].str, t->configs[f].str, t->configs[f].len, QOS, 1) != MQTTASYNC_SUCCESS) {
+        app_return_code = EXIT_FAILURE;
+    }
+}
+
+/**
+ * Remove retained HASS discovery configuration of a sensor, HASS deletes
+ * the entity on the empty message.
+ * @param client MQTT client.
+ * @param prefix Topic prefix the configuration was published with.
+ * @param rx Receiver.
+ * @param id Sensor id.
+ */
+static void clear_sensor_config(MQTTAsync client, const char *prefix, const struct receiver *rx, const char *id) {
+    char topic[MAX_TOPIC_SIZE];
+
+    int n = snprintf(topic, MAX_TOPIC_SIZE, MQTT_TOPIC_CONFIG, prefix, rx->client_id, id);
+    if (n < MAX_TOPIC_SIZE) {
+        publish(client, topic, "", 0, QOS, 1);
+    }
+}
+
+/**
+ * Publish availability and HASS discovery configuration for all sensors and
+ * feeder status of all receivers. Configs are retained by the broker, so HASS picks them
+ * up on its own subscription. They are send again on HASS birth message and
+ * reconnect, straight from the payloads interned per receiver.
+ * @param client MQTT client.
+ */
+static void publish_discovery(MQTTAsync client) {
+    if (publish(client, availability_topic.str, MQTT_AVAILABLE, (int) strlen(MQTT_AVAILABLE), QOS, 1) != MQTTASYNC_SUCCESS) {
+        app_return_code = EXIT_FAILURE;
+    }
+    for (int r = 0; r < num_receivers; ++r) {
+        const struct receiver *rx = &receivers[r];
+        for (int f = 0; f < topics.num_sensors; ++f) {
+            publish_sensor_config(client, rx, f);
+        }
+        if (publish(client, rx->topics.status_config_topic.str, rx->topics.status_config.str,
+                rx->topics.status_config.len, QOS, 1) != MQTTASYNC_SUCCESS) {
+            app_return_code = EXIT_FAILURE;
+        }
+    }
+}
+
+/**
+ * Take the sensors of the last built properties payload as sent, or drop
+ * them when it was not published, so they are included again next time.
+ * @param rx Receiver.
+ * @param published Payload was sent or queued.
+ * @param now Time of publishing.
+ */
+static void commit_properties(struct receiver *rx, int published, time_t now) {
+    for (int f = 0; f < topics.num_sensors; ++f) {
+        struct sensor_state *st = &rx->sensor_states[f];
+        if (st->pending && published) {
+            st->sent = rx->values[f];
+            st->sent_time = now;
+        }
+        st->pending = 0;
+    }
+    if (published) {
+        rx->running_sent = rx->feeder_status;
+    }
+}
+
+/**
+ * Publish changed sensor properties and feeder status of a receiver.
+ * A full snapshot is send periodically and when HASS comes online.
+ * Only values are formatted, keys come from topic table.
+ * @param client MQTT client.
+ * @param rx Receiver.
+ */
+static void publish_properties(MQTTAsync client, struct receiver *rx) {
+    struct json json;
+    size_t len;
+    time_t now = monotonic_seconds();
+    int full = rx->snapshot_pending || (snapshot_interval > 0 && now - rx->last_snapshot >= snapshot_interval);
+    uint64_t start = monotonic_us();
+
+    json_init(&json, payload, MAX_PAYLOAD_SIZE);
+    int count = build_properties(&json, rx, full);
+    histogram_add(&metrics.build, monotonic_us() - start);
+    if (count == 0) {
+        return; // Nothing changed
+    }
+    if (json_finish(&json, &len) == -1) {
+        fprintf(stderr, "publish %s error: payload exceeds %d bytes\n", rx->topics.properties_topic.str, MAX_PAYLOAD_SIZE);
+        app_return_code = EXIT_FAILURE;
+        commit_properties(rx, 0, now);
+        return;
+    }
+    if (publish(client, rx->topics.properties_topic.str, payload, (int) len, QOS, 0) != MQTTASYNC_SUCCESS) {
+        app_return_code = EXIT_FAILURE;
+        commit_properties(rx, 0, now);
+        return;
+    }
+    // Sent state changes only with a published payload.
+    commit_properties(rx, 1, now);
+    if (full) {
+        rx->snapshot_pending = 0;
+        rx->last_snapshot = now;
+    }
+}
+
+/**
+ * Publish statistics windows decoded by the last update of a receiver.
+ * The interval of a window restarts only when it was sent, a window
+ * not sent is decoded again on the next update.
+ * @param client MQTT client.
+ * @param rx Receiver.
+ */
+static void publish_windows(MQTTAsync client, struct receiver *rx) {
+    struct json json;
+    size_t len;
+
+    for (int w = 0; w < NUM_STATS_WINDOWS; ++w) {
+        struct window_state *ws = &rx->windows[w];
+        const char *topic = rx->topics.window_topics[w].str;
+        if (ws->msg == NULL) {
+            continue;
+        }
+        uint64_t start = monotonic_us();
+        json_init(&json, payload, MAX_PAYLOAD_SIZE);
+        build_window(&json, ws->msg);
+        ws->msg = NULL;
+        histogram_add(&metrics.build, monotonic_us() - start);
+        if (json_finish(&json, &len) == -1) {
+            fprintf(stderr, "publish %s error: payload exceeds %d bytes\n", topic, MAX_PAYLOAD_SIZE);
+            app_return_code = EXIT_FAILURE;
+            continue;
+        }
+        if (publish_group(client, COMPRESS_WINDOWS, topic, payload, (int) len, QOS, 0) != MQTTASYNC_SUCCESS) {
+            app_return_code = EXIT_FAILURE;
+            continue;
+        }
+        ws->last_sent = monotonic_seconds();
+    }
+}
+
+/**
+ * Publish polar range decoded by the last update of a receiver.
+ * A full frame is send first and every snapshot interval, changed bins
+ * in between. The all-time maximum is published retained when it grows
+ * and written to its file at most every POLAR_SAVE_INTERVAL.
+ * @param client MQTT client.
+ * @param rx Receiver.
+ */
+static void publish_polar(MQTTAsync client, struct receiver *rx) {
+    struct polar_state *ps = rx->polar;
+    struct json json;
+    size_t len;
+    time_t now = monotonic_seconds();
+    int changed = 1, full = 0;
+
+    if (ps == NULL || !ps->new) {
+        return;
+    }
+    ps->new = 0;
+    uint64_t start = monotonic_us();
+    json_init(&json, payload, MAX_PAYLOAD_SIZE);
+    if (ps->full_pending || (snapshot_interval > 0 && now - ps->last_full >= snapshot_interval)) {
+        polar_json(&json, &ps->current);
+        full = 1;
+    } else {
+        changed = polar_json_delta(&json, &ps->current, &ps->sent);
+    }
+    histogram_add(&metrics.build, monotonic_us() - start);
+    if (changed && json_finish(&json, &len) == 0) {
+        if (publish_group(client, COMPRESS_POLAR, rx->topics.polar_topic.str, payload, (int) len, QOS, 0) != MQTTASYNC_SUCCESS) {
+            app_return_code = EXIT_FAILURE;
+        } else {
+            // Bins not sent stay in the next delta.
+            ps->sent = ps->current;
+            if (full) {
+                ps->full_pending = 0;
+                ps->last_full = now;
+            }
+        }
+    }
+
+    if (ps->max_file == NULL) {
+        return;
+    }
+    if (polar_merge(&ps->max, &ps->current) > 0) {
+        ps->max_dirty = 1;
+        ps->max_pending = 1;
+    }
+    if (ps->max_pending) {
+        json_init(&json, payload, MAX_PAYLOAD_SIZE);
+        polar_json(&json, &ps->max);
+        if (json_finish(&json, &len) == 0
+                && publish_group(client, COMPRESS_POLAR, rx->topics.polar_max_topic.str, payload, (int) len, QOS, 1) == MQTTASYNC_SUCCESS) {
+            ps->max_pending = 0;
+        }
+    }
+    if (ps->max_dirty && now - ps->last_save >= POLAR_SAVE_INTERVAL
+            && polar_save(&ps->max, ps->max_file) == 0) {
+        ps->max_dirty = 0;
+        ps->last_save = now;
+    }
+}
+
+/**
+ * Read aircraft.pb of a receiver and publish state of aircraft with new
+ * messages. Frame timing is published to the aircraft stats topic.
+ * With raw passthrough the file is published unchanged first.
+ * @param client MQTT client.
+ * @param rx Receiver.
+ */
+static void publish_aircraft(MQTTAsync client, struct receiver *rx) {
+    AircraftsUpdate *msg;
+    struct json json;
+    char topic[MAX_TOPIC_SIZE];
+    char buf[FMT_BUF_SIZE];
+    size_t file_size, len, bytes = 0;
+    unsigned published = 0;
+
+    uint64_t start = monotonic_us();
+    const uint8_t *data = pbfile_read(&aircraft_file, rx->aircraft_path, &file_size);
+    if (data == NULL) {
+        return;
+    }
+    if (raw_enabled) {
+        publish_raw(client, rx->topics.raw_aircraft_topic.str, data, file_size);
+    }
+    if (!aircraft_enabled) {
+        pbfile_release(&aircraft_file);
+        return;
+    }
+    msg = aircrafts_update__unpack(&aircraft_arena.allocator, file_size, data);
+    pbfile_release(&aircraft_file);
+    if (msg == NULL || aircraft_tracker_reserve(&rx->aircraft_tracker, msg->n_aircraft) == -1) {
+        fprintf(stderr, "unpacking aircraft message failed\n");
+        arena_reset(&aircraft_arena);
+        return;
+    }
+    uint64_t decoded = monotonic_us();
+
+    // Topic prefix is fixed, only the address changes.
+    memcpy(topic, rx->topics.aircraft_topic.str, (size_t) rx->topics.aircraft_topic.len);
+    for (size_t i = 0; i < msg->n_aircraft; ++i) {
+        const AircraftMeta *a = msg->aircraft[i];
+        if (!aircraft_tracker_update(&rx->aircraft_tracker, a->addr, a->messages)) {
+            continue;
+        }
+        if ((size_t) rx->topics.aircraft_topic.len + AIRCRAFT_HEX_SIZE > MAX_TOPIC_SIZE) {
+            break;
+        }
+        aircraft_hex(topic + rx->topics.aircraft_topic.len, a->addr);
+        json_init(&json, payload, MAX_PAYLOAD_SIZE);
+        aircraft_json(&json, a);
+        if (json_finish(&json, &len) == 0
+                && publish_group(client, COMPRESS_AIRCRAFT, topic, payload, (int) len, AIRCRAFT_QOS, 0) == MQTTASYNC_SUCCESS) {
+            published++;
+            bytes += len;
+        }
+    }
+    aircraft_tracker_next(&rx->aircraft_tracker);
+    uint64_t now = msg->now;
+    size_t count = msg->n_aircraft;
+    arena_reset(&aircraft_arena);
+    uint64_t done = monotonic_us();
+
+    json_init(&json, payload, MAX_PAYLOAD_SIZE);
+    json_object_begin(&json);
+    len = fmt_u64(buf, now);
+    json_member_raw(&json, "now", buf, len);
+    len = fmt_u64(buf, count);
+    json_member_raw(&json, "aircraft", buf, len);
+    len = fmt_u64(buf, published);
+    json_member_raw(&json, "published", buf, len);
+    len = fmt_u64(buf, bytes);
+    json_member_raw(&json, "bytes", buf, len);
+    len = fmt_u64(buf, decoded - start);
+    json_member_raw(&json, "decode_us", buf, len);
+    len = fmt_u64(buf, done - decoded);
+    json_member_raw(&json, "publish_us", buf, len);
+    json_object_end(&json);
+    if (json_finish(&json, &len) == 0) {
+        publish_group(client, COMPRESS_AIRCRAFT, rx->topics.aircraft_stats_topic.str, payload, (int) len, AIRCRAFT_QOS, 0);
+    }
+}
+
+/**
+ * Publish pipeline metrics to the diagnostics topic when the interval is due.
+ * Counters and histograms are totals since start.
+ * @param client MQTT client.
+ */
+static void publish_diagnostics(MQTTAsync client) {
+    struct json json;
+    char buf[FMT_BUF_SIZE];
+    size_t len;
+    uint64_t compressed_in = 0, compressed_out = 0;
+    uint64_t stats_coalesced = 0, aircraft_coalesced = 0;
+    time_t now = monotonic_seconds();
+
+    if (diagnostics_interval <= 0 || now - last_diagnostics < diagnostics_interval) {
+        return;
+    }
+    last_diagnostics = now;
+    json_init(&json, payload, MAX_PAYLOAD_SIZE);
+    json_object_begin(&json);
+    json_member_raw(&json, "updates", buf, fmt_u64(buf, metrics.updates));
+    json_member_raw(&json, "dropped", buf, fmt_u64(buf, atomic_load(&metrics.dropped)));
+    json_member_raw(&json, "sent", buf, fmt_u64(buf, atomic_load(&pub_stats.sent)));
+    json_member_raw(&json, "acked", buf, fmt_u64(buf, atomic_load(&pub_stats.acked)));
+    json_member_raw(&json, "failed", buf, fmt_u64(buf, atomic_load(&pub_stats.failed)));
+    json_member_raw(&json, "bytes", buf, fmt_u64(buf, atomic_load(&pub_stats.bytes)));
+    json_member_raw(&json, "reconnects", buf, fmt_u64(buf, atomic_load(&metrics.reconnects)));
+    for (int r = 0; r < num_receivers; ++r) {
+        stats_coalesced += atomic_load(&receivers[r].stats_mailbox.coalesced);
+        aircraft_coalesced += atomic_load(&receivers[r].aircraft_mailbox.coalesced);
+    }
+    json_member_raw(&json, "stats_coalesced", buf, fmt_u64(buf, stats_coalesced));
+    json_member_raw(&json, "aircraft_coalesced", buf, fmt_u64(buf, aircraft_coalesced));
+    for (int g = 0; g < NUM_COMPRESS_GROUPS; ++g) {
+        if (compressors[g].ops) {
+            compressed_in += compressors[g].in_bytes;
+            compressed_out += compressors[g].out_bytes;
+        }
+    }
+    if (compressed_in) {
+        json_member_raw(&json, "compressed_in", buf, fmt_u64(buf, compressed_in));
+        json_member_raw(&json, "compressed_out", buf, fmt_u64(buf, compressed_out));
+    }
+    if (spool_path) {
+        json_member_raw(&json, "queued_bytes", buf, fmt_u64(buf, (uint64_t) (spool.write_off - spool.commit_off)));
+        json_member_raw(&json, "queue_dropped", buf, fmt_u64(buf, spool.dropped));
+    }
+    for (size_t i = 0; i < sizeof (pipeline_stages) / sizeof (pipeline_stages[0]); ++i) {
+        json_key(&json, pipeline_stages[i].name);
+        histogram_json(&json, pipeline_stages[i].h);
+    }
+    json_object_end(&json);
+    if (json_finish(&json, &len) == 0) {
+        publish(client, topics.diagnostics_topic.str, payload, (int) len, QOS, 0);
+    }
+}
+
+/**
+ * Arm one-shot broker timer.
+ * @param ms Delay in milliseconds.
+ */
+static void arm_broker_timer(int ms) {
+    struct itimerspec its = {
+        .it_interval = {0, 0},
+        .it_value = {.tv_sec = ms / 1000, .tv_nsec = (long) (ms % 1000) * 1000000}
+    };
+    if (timerfd_settime(broker_timer_fd, 0, &its, NULL) == -1) {
+        fprintf(stderr, "timerfd error: %s\n", strerror(errno));
+    }
+}
+
+/**
+ * Schedule next reconnect attempt with exponential backoff. The delay is
+ * drawn from its upper half, so many clients do not retry in lockstep.
+ */
+static void schedule_reconnect(void) {
+    int shift = reconnect_attempt < 16 ? reconnect_attempt : 16;
+    long delay = (long) RECONNECT_MIN_MS << shift;
+    if (delay > RECONNECT_MAX_MS) {
+        delay = RECONNECT_MAX_MS;
+    }
+    delay = delay / 2 + rand() % (delay / 2 + 1);
+    reconnect_attempt++;
+    broker_state = BROKER_DISCONNECTED;
+    fprintf(stderr, "reconnecting in %ld ms\n", delay);
+    arm_broker_timer((int) delay);
+}
+
+/**
+ * Send a batch of queued messages in order. Next batch is sent on the
+ * next tick, so a long queue does not flood the broker or stall updates.
+ * @param client MQTT client.
+ */
+static void flush_spool(MQTTAsync client) {
+    struct spool_record rec;
+
+    // Batch boundary, a restart continues behind the messages acknowledged so far.
+    spool_sync(&spool);
+    for (int i = 0; i < SPOOL_BATCH && broker_state == BROKER_CONNECTED && !inflight_full(); ++i) {
+        int rc = spool_peek(&spool, &rec);
+        if (rc == 0) {
+            break;
+        }
+        if (rc == -1) {
+            fprintf(stderr, "queue %s read error, queued messages dropped\n", spool_path ? spool_path : "in memory");
+            spool_clear(&spool);
+            break;
+        }
+        off_t end = spool.read_off + (off_t) spool.next_len;
+        if (publish_now(client, rec.topic, rec.data, rec.len, rec.qos, rec.retained, end) != MQTTASYNC_SUCCESS) {
+            break; // Retried on next tick
+        }
+        spool_consume(&spool);
+    }
+    // With a full window the next batch follows when a slot is freed.
+    if (broker_state == BROKER_CONNECTED && spool_pending(&spool) && !inflight_full()) {
+        arm_broker_timer(SPOOL_FLUSH_MS);
+    }
+}
+
+/**
+ * Broker timer expired: reconnect when disconnected, flush queue when connected.
+ * @param client MQTT client.
+ */
+static void handle_broker_timer(MQTTAsync client) {
+    uint64_t expirations;
+    int mqtt_rc;
+
+    if (read(broker_timer_fd, &expirations, sizeof (expirations)) != sizeof (expirations)) {
+        return;
+    }
+    if (broker_state == BROKER_DISCONNECTED) {
+        atomic_store(&connect_result, 1);
+        broker_state = BROKER_CONNECTING;
+        if ((mqtt_rc = MQTTAsync_connect(client, &connect_options)) != MQTTASYNC_SUCCESS) {
+            fprintf(stderr, "connect error: %s\n", MQTTAsync_strerror(mqtt_rc));
+            schedule_reconnect();
+        }
+    } else if (broker_state == BROKER_CONNECTED) {
+        flush_spool(client);
+    }
+}
+
+/**
+ * Handle events signalled by the MQTT client thread: connect result,
+ * connection loss, HASS birth message and completed publishes.
+ * @param client MQTT client.
+ */
+static void handle_broker(MQTTAsync client) {
+    uint64_t count;
+    int mqtt_rc;
+
+    if (read(broker_fd, &count, sizeof (count)) == -1 && errno != EAGAIN) {
+        fprintf(stderr, "broker event read error: %s\n", strerror(errno));
+    }
+    inflight_reap();
+    // Connect result first, a loss right after connecting follows it.
+    if (broker_state == BROKER_CONNECTING) {
+        int rc = atomic_load(&connect_result);
+        if (rc < 0) {
+            schedule_reconnect();
+        } else if (rc == 0) {
+            fprintf(stderr, "reconnected to broker after %d attempts\n", reconnect_attempt);
+            broker_state = BROKER_CONNECTED;
+            reconnect_attempt = 0;
+            atomic_fetch_add(&metrics.reconnects, 1);
+            // Clean session, subscription is gone. Send discovery and full state again.
+            if ((mqtt_rc = MQTTAsync_subscribe(client, hass_status_topic, QOS, NULL)) != MQTTASYNC_SUCCESS) {
+                fprintf(stderr, "subscribe %s error: %s\n", hass_status_topic, MQTTAsync_strerror(mqtt_rc));
+            }
+            atomic_store(&discovery_pending, 1);
+            for (int r = 0; r < num_receivers; ++r) {
+                if (receivers[r].polar) {
+                    receivers[r].polar->max_pending = 1;
+                }
+            }
+            if (spool_pending(&spool)) {
+                arm_broker_timer(SPOOL_FLUSH_MS);
+            }
+        }
+    }
+    if (atomic_exchange(&link_lost, 0) && broker_state == BROKER_CONNECTED) {
+        inflight_reset();
+        reconnect_attempt = 0;
+        schedule_reconnect();
+    }
+    if (broker_state == BROKER_CONNECTED && atomic_exchange(&discovery_pending, 0)) {
+        publish_discovery(client);
+        for (int r = 0; r < num_receivers; ++r) {
+            receivers[r].snapshot_pending = 1;
+            // HASS needs current state too, properties are not retained.
+            if (receivers[r].last_stats_time) {
+                receivers[r].publish_pending = 1;
+            }
+        }
+    }
+    // Slots freed, send what waits for them.
+    if (broker_state == BROKER_CONNECTED && spool_pending(&spool) && !inflight_full()) {
+        flush_spool(client);
+    }
+}
+
+/**
+ * Reload config file and apply changed settings without reconnecting,
+ * unless broker credentials changed. Only tables depending on changed
+ * settings are rebuilt. The previous tables are kept until the new ones
+ * are complete, so an invalid file changes nothing.
+ * @param client MQTT client.
+ */
+static void reload_config(MQTTAsync client) {
+    static struct receiver_topics old_rx_topics[MAX_RECEIVERS];
+    static double *old_values[MAX_RECEIVERS];
+    static struct sensor_state *old_states[MAX_RECEIVERS];
+    struct sensor_table old_sensors = sensors;
+    struct topic_table old_topics = topics;
+    int old_temperature = temperature_sensor;
+    struct settings next;
+    int mqtt_rc, rc = 0;
+
+    if (load_settings(&next) == -1) {
+        fprintf(stderr, "config %s not applied, keeping previous settings\n", config_path);
+        return;
+    }
+    int changed = settings_changes(&active_settings, &next);
+    if (changed == 0) {
+        settings_free(&next);
+        return;
+    }
+    int new_sensors = changed & CHANGED_SENSORS;
+    int new_topics = changed & (CHANGED_SENSORS | CHANGED_PREFIX);
+    int new_rx_topics = changed & (CHANGED_SENSORS | CHANGED_PREFIX | CHANGED_WINDOWS);
+    int new_states = changed & (CHANGED_SENSORS | CHANGED_DEADBANDS);
+
+    // Start rebuilt tables empty, so cleanup does not depend on where building failed.
+    use_settings(&next);
+    if (new_sensors) {
+        memset(&sensors, 0, sizeof (sensors));
+    }
+    if (new_topics) {
+        memset(&topics, 0, sizeof (topics));
+    }
+    for (int r = 0; r < num_receivers; ++r) {
+        struct receiver *rx = &receivers[r];
+        old_rx_topics[r] = rx->topics;
+        old_values[r] = rx->values;
+        old_states[r] = rx->sensor_states;
+        if (new_rx_topics) {
+            memset(&rx->topics, 0, sizeof (rx->topics));
+        }
+        if (new_states) {
+            rx->values = NULL;
+            rx->sensor_states = NULL;
+        }
+    }
+    if ((new_sensors && build_sensors() == -1) || (new_topics && build_topics() == -1)) {
+        rc = -1;
+    }
+    for (int r = 0; r < num_receivers && rc == 0; ++r) {
+        struct receiver *rx = &receivers[r];
+        if ((new_rx_topics && build_receiver_topics(rx) == -1)
+                || (new_states && remap_sensor_states(rx, &old_sensors, old_values[r], old_states[r]) == -1)) {
+            rc = -1;
+        }
+    }
+    if (rc == -1) {
+        for (int r = 0; r < num_receivers; ++r) {
+            struct receiver *rx = &receivers[r];
+            if (new_rx_topics) {
+                free_receiver_topics(&rx->topics);
+                rx->topics = old_rx_topics[r];
+            }
+            if (new_states) {
+                free(rx->values);
+                free(rx->sensor_states);
+                rx->values = old_values[r];
+                rx->sensor_states = old_states[r];
+            }
+        }
+        if (new_topics) {
+            free_topics(&topics);
+            topics = old_topics;
+        }
+        if (new_sensors) {
+            sensor_table_destroy(&sensors);
+            sensors = old_sensors;
+            temperature_sensor = old_temperature;
+        }
+        use_settings(&active_settings);
+        settings_free(&next);
+        fprintf(stderr, "config %s not applied, keeping previous settings\n", config_path);
+        return;
+    }
+
+    // Discovery: a new prefix moves all configs, otherwise only added and removed sensors change.
+    for (int r = 0; r < num_receivers && new_topics; ++r) {
+        struct receiver *rx = &receivers[r];
+        for (int f = 0; f < old_sensors.count; ++f) {
+            const char *id = old_sensors.entry[f].id;
+            if ((changed & CHANGED_PREFIX) || sensor_table_find(&sensors, id, strlen(id)) == -1) {
+                clear_sensor_config(client, active_settings.topic_prefix, rx, id);
+            }
+        }
+        if (broker_state == BROKER_CONNECTED && !(changed & CHANGED_PREFIX)) {
+            for (int f = 0; f < sensors.count; ++f) {
+                if (sensor_table_find(&old_sensors, sensors.entry[f].id, strlen(sensors.entry[f].id)) == -1) {
+                    publish_sensor_config(client, rx, f);
+                }
+            }
+        }
+        rx->snapshot_pending = 1;
+        if (rx->last_stats_time) {
+            rx->publish_pending = 1;
+        }
+    }
+    if (broker_state == BROKER_CONNECTED && (changed & CHANGED_PREFIX)) {
+        publish_discovery(client);
+    }
+    if (broker_state == BROKER_CONNECTED && (changed & CHANGED_HASS_STATUS)) {
+        MQTTAsync_unsubscribe(client, active_settings.hass_status_topic, NULL);
+        if ((mqtt_rc = MQTTAsync_subscribe(client, hass_status_topic, QOS, NULL)) != MQTTASYNC_SUCCESS) {
+            fprintf(stderr, "subscribe %s error: %s\n", hass_status_topic, MQTTAsync_strerror(mqtt_rc));
+        }
+    }
+    for (int r = 0; r < num_receivers; ++r) {
+        if (new_rx_topics) {
+            free_receiver_topics(&old_rx_topics[r]);
+        }
+        if (new_states) {
+            free(old_values[r]);
+            free(old_states[r]);
+        }
+    }
+    if (new_topics) {
+        free_topics(&old_topics);
+    }
+    if (new_sensors) {
+        sensor_table_destroy(&old_sensors);
+    }
+    settings_free(&active_settings);
+    active_settings = next;
+    fprintf(stderr, "config %s applied\n", config_path);
+
+    // Credentials are sent on connect only.
+    if ((changed & CHANGED_CREDENTIALS) && broker_state == BROKER_CONNECTED) {
+        MQTTAsync_disconnectOptions disconnect_options = MQTTAsync_disconnectOptions_initializer;
+        disconnect_options.timeout = 1000;
+        if ((mqtt_rc = MQTTAsync_disconnect(client, &disconnect_options)) != MQTTASYNC_SUCCESS) {
+            fprintf(stderr, "disconnect error: %s\n", MQTTAsync_strerror(mqtt_rc));
+        }
+        inflight_reset();
+        reconnect_attempt = 0;
+        schedule_reconnect();
+    }
+}
+
+/**
+ * Append OpenMetrics counter with one sample.
+ * @param name Metric name without _total suffix.
+ * @param help Help text.
+ * @param value Counter value.
+ */
+static void render_counter(const char *name, const char *help, uint64_t value) {
+    char buf[FMT_BUF_SIZE];
+
+    exporter_append_string(&exporter, "# TYPE ");
+    exporter_append_string(&exporter, name);
+    exporter_append_string(&exporter, " counter\n# HELP ");
+    exporter_append_string(&exporter, name);
+    exporter_append_string(&exporter, " ");
+    exporter_append_string(&exporter, help);
+    exporter_append_string(&exporter, "\n");
+    exporter_append_string(&exporter, name);
+    exporter_append_string(&exporter, "_total ");
+    exporter_append(&exporter, buf, fmt_u64(buf, value));
+    exporter_append_string(&exporter, "\n");
+}
+
+/**
+ * Render exporter page from the values of the last update of all receivers
+ * and the pipeline metrics. Each statistics field is a gauge labeled with
+ * receiver client id and window, values are unscaled.
+ */
+static void render_exporter(void) {
+    static const char *window_names[NUM_EXPORT_WINDOWS] = {"last_1min", "total"};
+    char buf[FMT_BUF_SIZE];
+
+    exporter_begin(&exporter);
+    for (int f = 0; f < export_sensors.count; ++f) {
+        const struct sensor *s = &export_sensors.entry[f];
+        exporter_append_string(&exporter, "# TYPE readsb_");
+        exporter_append_string(&exporter, s->id);
+        exporter_append_string(&exporter, " gauge\n# HELP readsb_");
+        exporter_append_string(&exporter, s->id);
+        exporter_append_string(&exporter, " ");
+        exporter_append_string(&exporter, s->name);
+        exporter_append_string(&exporter, "\n");
+        for (int r = 0; r < num_receivers; ++r) {
+            const struct receiver *rx = &receivers[r];
+            for (int w = 0; w < NUM_EXPORT_WINDOWS; ++w) {
+                if (!(rx->export_mask & (1u << w))) {
+                    continue;
+                }
+                exporter_append_string(&exporter, "readsb_");
+                exporter_append_string(&exporter, s->id);
+                exporter_append_string(&exporter, "{receiver=\"");
+                exporter_append_label(&exporter, rx->client_id);
+                exporter_append_string(&exporter, "\",window=\"");
+                exporter_append_string(&exporter, window_names[w]);
+                exporter_append_string(&exporter, "\"} ");
+                exporter_append(&exporter, buf, format_value(buf, s, rx->export_values[w * export_sensors.count + f]));
+                exporter_append_string(&exporter, "\n");
+            }
+        }
+    }
+
+    render_counter("readsbmqtt_updates", "Statistics updates processed", metrics.updates);
+    render_counter("readsbmqtt_dropped_updates", "Statistics updates coalesced or unreadable", atomic_load(&metrics.dropped));
+    render_counter("readsbmqtt_messages_sent", "MQTT messages sent", atomic_load(&pub_stats.sent));
+    render_counter("readsbmqtt_messages_acked", "MQTT messages acknowledged", atomic_load(&pub_stats.acked));
+    render_counter("readsbmqtt_messages_failed", "MQTT messages failed", atomic_load(&pub_stats.failed));
+    render_counter("readsbmqtt_sent_bytes", "MQTT payload bytes sent", atomic_load(&pub_stats.bytes));
+    render_counter("readsbmqtt_reconnects", "MQTT reconnects", atomic_load(&metrics.reconnects));
+
+    // Input files replaced again before read, per receiver and file
+    exporter_append_string(&exporter, "# TYPE readsbmqtt_coalesced_frames counter\n"
+            "# HELP readsbmqtt_coalesced_frames Input files replaced again before read\n");
+    for (int r = 0; r < num_receivers; ++r) {
+        struct receiver *rx = &receivers[r];
+        struct mailbox *mailboxes[2] = {&rx->stats_mailbox, &rx->aircraft_mailbox};
+        const char *files[2] = {READSB_STATS_FILE_PB, READSB_AIRCRAFT_FILE_PB};
+        for (int i = 0; i < 2; ++i) {
+            exporter_append_string(&exporter, "readsbmqtt_coalesced_frames_total{receiver=\"");
+            exporter_append_label(&exporter, rx->client_id);
+            exporter_append_string(&exporter, "\",file=\"");
+            exporter_append_string(&exporter, files[i]);
+            exporter_append_string(&exporter, "\"} ");
+            exporter_append(&exporter, buf, fmt_u64(buf, atomic_load(&mailboxes[i]->coalesced)));
+            exporter_append_string(&exporter, "\n");
+        }
+    }
+
+    exporter_append_string(&exporter, "# TYPE readsbmqtt_stage_seconds histogram\n"
+            "# HELP readsbmqtt_stage_seconds Duration of pipeline stages\n");
+    for (size_t i = 0; i < sizeof (pipeline_stages) / sizeof (pipeline_stages[0]); ++i) {
+        const struct histogram *h = pipeline_stages[i].h;
+        uint64_t count = 0;
+        for (int b = 0; b < HISTOGRAM_BUCKETS; ++b) {
+            count += atomic_load_explicit(&h->bucket[b], memory_order_relaxed);
+            exporter_append_string(&exporter, "readsbmqtt_stage_seconds_bucket{stage=\"");
+            exporter_append_string(&exporter, pipeline_stages[i].name);
+            exporter_append_string(&exporter, "\",le=\"");
+            if (b < HISTOGRAM_BUCKETS - 1) {
+                exporter_append(&exporter, buf, fmt_fixed(buf, (double) histogram_bound(b) / 1e6, 6));
+            } else {
+                exporter_append_string(&exporter, "+Inf");
+            }
+            exporter_append_string(&exporter, "\"} ");
+            exporter_append(&exporter, buf, fmt_u64(buf, count));
+            exporter_append_string(&exporter, "\n");
+        }
+        exporter_append_string(&exporter, "readsbmqtt_stage_seconds_count{stage=\"");
+        exporter_append_string(&exporter, pipeline_stages[i].name);
+        exporter_append_string(&exporter, "\"} ");
+        exporter_append(&exporter, buf, fmt_u64(buf, count));
+        exporter_append_string(&exporter, "\nreadsbmqtt_stage_seconds_sum{stage=\"");
+        exporter_append_string(&exporter, pipeline_stages[i].name);
+        exporter_append_string(&exporter, "\"} ");
+        exporter_append(&exporter, buf, fmt_fixed(buf, (double) atomic_load_explicit(&h->sum, memory_order_relaxed) / 1e6, 6));
+        exporter_append_string(&exporter, "\n");
+    }
+    exporter_append_string(&exporter, "# EOF\n");
+    if (exporter_commit(&exporter) == -1) {
+        fprintf(stderr, "exporter page allocation failed\n");
+    }
+}
+
+int main(int argc, char* argv[]) {
+    MQTTAsync client;
+    MQTTAsync_disconnectOptions disconnect_options = MQTTAsync_disconnectOptions_initializer;
+    int mqtt_rc;
+    int epoll_fd = -1, signal_fd = -1, timer_fd = -1;
+    sigset_t mask;
+
+    // Termination signals are handled through signalfd in the event loop.
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1) {
+        fprintf(stderr, "sigprocmask error: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    signal(SIGABRT, signal_handler);
+
+    // Set defaults
+    server_uri = strdup("tcp://localhost:1883");
+    client_id = strdup("feeder001");
+    topic_prefix = strdup("homeassistant/sensor");
+    hass_status_topic = strdup("homeassistant/status");
+
+    // Parse the command line options
+    if (argp_parse(&argp, argc, argv, 0, 0, 0)) {
+        return EXIT_FAILURE;
+    }
+    // Config file settings override the command line, and are applied again when it changes.
+    if (settings_capture(&base_settings) == -1 || load_settings(&active_settings) == -1) {
+        fprintf(stderr, "unable to load settings\n");
+        app_return_code = EXIT_FAILURE;
+        goto exit;
+    }
+    use_settings(&active_settings);
+
+    // Topics and payloads are fixed from here on, until the config file changes
+    if (build_sensors() == -1) {
+        fprintf(stderr, "unable to build sensor table\n");
+        app_return_code = EXIT_FAILURE;
+        goto exit;
+    }
+    if (exporter_addr && sensor_table_init(&export_sensors, &statistic_entry__descriptor, NULL, NULL, 0, NULL, 0, NULL, 0) == -1) {
+        fprintf(stderr, "unable to build exporter table\n");
+        app_return_code = EXIT_FAILURE;
+        goto exit;
+    }
+    if (build_topics() == -1) {
+        fprintf(stderr, "unable to build topics\n");
+        app_return_code = EXIT_FAILURE;
+        goto exit;
+    }
+    // Discovery configs of all receivers refer to the availability topic.
+    // The topic keeps the prefix given at startup, a reload cannot change the will.
+    if (intern_topic(&availability_topic, MQTT_TOPIC_AVAILABILITY, topic_prefix, client_id) == -1) {
+        app_return_code = EXIT_FAILURE;
+        goto exit;
+    }
+    // Without receiver options the default readsb directory is watched.
+    for (int r = 0; r < (num_receiver_args ? num_receiver_args : 1); ++r) {
+        num_receivers++;
+        if (init_receiver(&receivers[r], num_receiver_args ? receiver_args[r] : NULL, r == 0) == -1) {
+            fprintf(stderr, "unable to set up receiver %s\n", num_receiver_args ? receiver_args[r] : READSB_DIR);
+            app_return_code = EXIT_FAILURE;
+            goto exit;
+        }
+    }
+
+    // Create last will: client not available.
+    // There is one will per session, it covers all receivers.
+    lwt_options.topicName = availability_topic.str;
+    lwt_options.message = MQTT_NOT_AVAILABLE;
+    lwt_options.retained = 1;
+    lwt_options.qos = QOS;
+
+    // Broker events from MQTT client thread, e.g. connection lost
+    broker_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    // Decode requests and results between event loop and decode worker
+    decode_fd = eventfd(0, EFD_CLOEXEC);
+    decoded_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (broker_fd == -1 || decode_fd == -1 || decoded_fd == -1) {
+        fprintf(stderr, "eventfd error: %s\n", strerror(errno));
+        app_return_code = EXIT_FAILURE;
+        goto exit;
+    }
+
+    inflight = calloc((size_t) inflight_window, sizeof (struct inflight_msg));
+    if (inflight == NULL
+            || (aircraft_enabled && arena_init(&aircraft_arena, AIRCRAFT_ARENA_SIZE) == -1)) {
+        fprintf(stderr, "unable to allocate buffers\n");
+        app_return_code = EXIT_FAILURE;
+        goto exit;
+    }
+    // Compressor state is kept for all payloads of a group.
+    for (int g = 0; g < NUM_COMPRESS_GROUPS; ++g) {
+        if (compress_ops[g] && codec_init(&compressors[g], compress_ops[g], compress_level[g]) == -1) {
+            fprintf(stderr, "unable to set up %s compression for %s\n", compress_ops[g]->name, compress_groups[g]);
+            app_return_code = EXIT_FAILURE;
+            goto exit;
+        }
+    }
+
+    if ((mqtt_rc = MQTTAsync_create(&client, server_uri, client_id, MQTTCLIENT_PERSISTENCE_NONE, NULL)) != MQTTASYNC_SUCCESS) {
+        fprintf(stderr, "create client error: %s\n", MQTTAsync_strerror(mqtt_rc));
+        app_return_code = EXIT_FAILURE;
+        goto exit;
+    }
+
+    if ((mqtt_rc = MQTTAsync_setCallbacks(client, NULL, connection_lost, msg_arrived, NULL)) != MQTTASYNC_SUCCESS) {
+        fprintf(stderr, "set callbacks error: %s\n", MQTTAsync_strerror(mqtt_rc));
+        app_return_code = EXIT_FAILURE;
+        goto destroy_exit;
+    }
+
+    // Reconnect jitter differs between hosts restarted at the same time.
+    srand((unsigned) time(NULL) ^ (unsigned) getpid());
+
+    // Messages queued by a previous run are sent once connected.
+    if (spool_open(&spool, spool_path, spool_path ? spool_size : (size_t) SPOOL_MEMORY * 1024 * 1024) == -1) {
+        app_return_code = EXIT_FAILURE;
+        goto destroy_exit;
+    }
+
+    connect_options.keepAliveInterval = 20;
+    connect_options.cleansession = 1;
+    connect_options.maxInflight = inflight_window;
+    connect_options.will = &lwt_options;
+    connect_options.onSuccess = on_connect;
+    connect_options.onFailure = on_connect_failure;
+    if ((mqtt_rc = MQTTAsync_connect(client, &connect_options)) != MQTTASYNC_SUCCESS) {
+        fprintf(stderr, "connect error: %s\n", MQTTAsync_strerror(mqtt_rc));
+        app_return_code = EXIT_FAILURE;
+        goto destroy_exit;
+    }
+    // Wait for connect completion
+    while (atomic_load(&connect_result) > 0 && broker_wait(TIMEOUT)) {
+    }
+    if (atomic_load(&connect_result) != 0) {
+        fprintf(stderr, "connect error: %s\n", atomic_load(&connect_result) > 0 ? "timeout" : "refused");
+        app_return_code = EXIT_FAILURE;
+        goto destroy_exit;
+    }
+    broker_state = BROKER_CONNECTED;
+
+    // Announce sensors once, and again whenever HASS restarts.
+    publish_discovery(client);
+    if ((mqtt_rc = MQTTAsync_subscribe(client, hass_status_topic, QOS, NULL)) != MQTTASYNC_SUCCESS) {
+        fprintf(stderr, "subscribe %s error: %s\n", hass_status_topic, MQTTAsync_strerror(mqtt_rc));
+        app_return_code = EXIT_FAILURE;
+        goto disconnect_exit;
+    }
+
+    // Add notification on stats file when connected to MQTT broker
+    // Create inotify instance
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd == -1) {
+        fprintf(stderr, "inotify_init error: %s\n", strerror(errno));
+        app_return_code = EXIT_FAILURE;
+        goto disconnect_exit;
+    }
+
+    // Add notification watch to readsb stats file when closed after write.
+    // Notify also when stats.pb gets deleted (readsb stopped).
+    for (int r = 0; r < num_receivers; ++r) {
+        receivers[r].wd = inotify_add_watch(inotify_fd, receivers[r].dir, IN_MOVED_TO | IN_DELETE);
+        if (receivers[r].wd == -1) {
+            fprintf(stderr, "inotify_add_watch %s error: readsb running? %s\n", receivers[r].dir, strerror(errno));
+            app_return_code = EXIT_FAILURE;
+            goto disconnect_exit;
+        }
+    }
+    // Watch the directory, editors and config management replace the file.
+    if (config_path) {
+        char *slash = strrchr(config_path, '/');
+        char *dir = slash ? strndup(config_path, slash == config_path ? 1 : (size_t) (slash - config_path)) : strdup(".");
+        config_name = slash ? slash + 1 : config_path;
+        config_wd = dir ? inotify_add_watch(inotify_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_MASK_ADD) : -1;
+        if (config_wd == -1) {
+            fprintf(stderr, "inotify_add_watch %s error: %s\n", dir ? dir : config_path, strerror(errno));
+            free(dir);
+            app_return_code = EXIT_FAILURE;
+            goto disconnect_exit;
+        }
+        free(dir);
+    }
+
+    signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signal_fd == -1) {
+        fprintf(stderr, "signalfd error: %s\n", strerror(errno));
+        app_return_code = EXIT_FAILURE;
+        goto disconnect_exit;
+    }
+
+    // Periodic timer for connection and staleness checks
+    struct itimerspec its = {
+        .it_interval = {.tv_sec = TIMER_INTERVAL, .tv_nsec = 0},
+        .it_value = {.tv_sec = TIMER_INTERVAL, .tv_nsec = 0}
+    };
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd == -1 || timerfd_settime(timer_fd, 0, &its, NULL) == -1) {
+        fprintf(stderr, "timerfd error: %s\n", strerror(errno));
+        app_return_code = EXIT_FAILURE;
+        goto disconnect_exit;
+    }
+    broker_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (broker_timer_fd == -1) {
+        fprintf(stderr, "timerfd error: %s\n", strerror(errno));
+        app_return_code = EXIT_FAILURE;
+        goto disconnect_exit;
+    }
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1
+            || epoll_add(epoll_fd, inotify_fd, EV_INOTIFY) == -1
+            || epoll_add(epoll_fd, signal_fd, EV_SIGNAL) == -1
+            || epoll_add(epoll_fd, timer_fd, EV_TIMER) == -1
+            || epoll_add(epoll_fd, broker_fd, EV_BROKER) == -1
+            || epoll_add(epoll_fd, broker_timer_fd, EV_BROKER_TIMER) == -1
+            || epoll_add(epoll_fd, decoded_fd, EV_DECODED) == -1) {
+        fprintf(stderr, "epoll error: %s\n", strerror(errno));
+        app_return_code = EXIT_FAILURE;
+        goto disconnect_exit;
+    }
+    if (exporter_addr) {
+        if (exporter_init(&exporter, exporter_addr, epoll_fd, EV_EXPORTER) == -1) {
+            app_return_code = EXIT_FAILURE;
+            goto disconnect_exit;
+        }
+        render_exporter();
+    }
+    if (spool_pending(&spool)) {
+        arm_broker_timer(SPOOL_FLUSH_MS);
+    }
+    // Termination signals stay blocked in the worker, it inherits the mask.
+    if ((errno = pthread_create(&decode_thread, NULL, decode_worker, NULL)) != 0) {
+        fprintf(stderr, "decode worker error: %s\n", strerror(errno));
+        app_return_code = EXIT_FAILURE;
+        goto disconnect_exit;
+    }
+
+    // Run this until we get a termination signal.
+    // The MQTT client thread handles keep alive, we sleep until something happens.
+    while (!app_exit) {
+        struct epoll_event events[MAX_EVENTS];
+        int n = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "epoll_wait error: %s\n", strerror(errno));
+            app_return_code = EXIT_FAILURE;
+            break;
+        }
+        for (int e = 0; e < n; ++e) {
+            switch (events[e].data.u32) {
+                case EV_INOTIFY:
+                    handle_inotify();
+                    break;
+                case EV_SIGNAL:
+                    handle_signal(signal_fd);
+                    break;
+                case EV_TIMER:
+                    handle_timer(timer_fd, client);
+                    publish_diagnostics(client);
+                    break;
+                case EV_BROKER:
+                    handle_broker(client);
+                    break;
+                case EV_BROKER_TIMER:
+                    handle_broker_timer(client);
+                    break;
+                case EV_DECODED:
+                {
+                    uint64_t count;
+                    if (read(decoded_fd, &count, sizeof (count)) == -1 && errno != EAGAIN) {
+                        fprintf(stderr, "decode event read error: %s\n", strerror(errno));
+                    }
+                    break; // Frames are taken below
+                }
+                case EV_EXPORTER:
+                    exporter_accept(&exporter);
+                    break;
+                default:
+                    if (events[e].data.u32 > EV_EXPORTER) {
+                        exporter_handle(&exporter, (int) (events[e].data.u32 - EV_EXPORTER - 1));
+                    }
+                    break;
+            }
+        }
+        if (atomic_exchange(&publish_failed, 0)) {
+            app_return_code = EXIT_FAILURE;
+        }
+        if (config_pending) {
+            config_pending = 0;
+            reload_config(client);
+        }
+        // Receivers are processed one after the other, decode buffers are shared.
+        for (int r = 0; r < num_receivers && !app_exit; ++r) {
+            struct receiver *rx = &receivers[r];
+            if (mailbox_take(&rx->aircraft_mailbox)) {
+                publish_aircraft(client, rx);
+            }
+            struct stats_frame *fr = frame_take(rx);
+            if (fr) {
+                update_from_stats(client, rx, fr);
+                rx->publish_pending = 1;
+                exporter_dirty = 1;
+            }
+            if (rx->publish_pending) {
+                rx->publish_pending = 0;
+                publish_properties(client, rx);
+                publish_windows(client, rx);
+                publish_polar(client, rx);
+            }
+            frame_release(rx);
+        }
+        // One render per loop pass covers all receivers updated in it.
+        if (exporter_addr && exporter_dirty) {
+            exporter_dirty = 0;
+            render_exporter();
+        }
+    }
+    atomic_store(&decode_exit, 1);
+    uint64_t wake = 1;
+    if (write(decode_fd, &wake, sizeof (wake)) == -1) {
+        fprintf(stderr, "decode worker stop error: %s\n", strerror(errno));
+    }
+    pthread_join(decode_thread, NULL);
+
+disconnect_exit:
+    // Publish client not running status and not available on _expected_ disconnect
+    // Last will is send only on _unexpected_ disconnect.
+    if (MQTTAsync_isConnected(client)) {
+        for (int r = 0; r < num_receivers; ++r) {
+            inflight_drain(inflight_window - 1, 1000);
+            publish_now(client, receivers[r].topics.properties_topic.str, topics.offline.str, topics.offline.len, QOS, 0, 0);
+        }
+        inflight_drain(inflight_window - 1, 1000);
+        publish_now(client, availability_topic.str, MQTT_NOT_AVAILABLE, (int) strlen(MQTT_NOT_AVAILABLE), QOS, 1, 0);
+        inflight_drain(0, 1000);
+
+        disconnect_options.timeout = 1000;
+        disconnect_options.onSuccess = on_disconnect;
+        disconnect_options.onFailure = on_disconnect_failure;
+        if ((mqtt_rc = MQTTAsync_disconnect(client, &disconnect_options)) != MQTTASYNC_SUCCESS) {
+            fprintf(stderr, "disconnect error: %s\n", MQTTAsync_strerror(mqtt_rc));
+            app_return_code = EXIT_FAILURE;
+        } else {
+            broker_wait(2000);
+        }
+    }
+    fprintf(stderr, "messages sent: %" PRIuFAST64 ", acknowledged: %" PRIuFAST64 ", failed: %" PRIuFAST64 "\n",
+            atomic_load(&pub_stats.sent), atomic_load(&pub_stats.acked), atomic_load(&pub_stats.failed));
+    size_t stats_peak = 0;
+    uint64_t stats_heap_allocs = 0;
+    for (int r = 0; r < num_receivers; ++r) {
+        for (int i = 0; i < 2; ++i) {
+            if (receivers[r].frames[i].arena.peak > stats_peak) {
+                stats_peak = receivers[r].frames[i].arena.peak;
+            }
+            stats_heap_allocs += receivers[r].frames[i].arena.heap_allocs;
+        }
+    }
+    fprintf(stderr, "stats arena peak: %zu bytes, heap allocations: %" PRIu64 "\n",
+            stats_peak, stats_heap_allocs);
+    if (spool_path) {
+        fprintf(stderr, "queue dropped: %" PRIu64 ", left queued: %lld bytes\n",
+                spool.dropped, (long long) (spool.write_off - spool.commit_off));
+    }
+
+    for (int r = 0; r < num_receivers; ++r) {
+        if (receivers[r].polar && receivers[r].polar->max_dirty) {
+            polar_save(&receivers[r].polar->max, receivers[r].polar->max_file);
+        }
+    }
+
+destroy_exit:
+    MQTTAsync_destroy(&client);
+
+exit:
+    free(inflight);
+    for (int r = 0; r < num_receivers; ++r) {
+        if (inotify_fd != -1 && receivers[r].wd != -1) {
+            inotify_rm_watch(inotify_fd, receivers[r].wd);
+        }
+        free_receiver(&receivers[r]);
+    }
+    sensor_table_destroy(&sensors);
+    sensor_table_destroy(&export_sensors);
+    if (exporter.source) {
+        exporter_destroy(&exporter);
+    }
+    free(exporter_addr);
+    spool_close(&spool);
+    for (int g = 0; g < NUM_COMPRESS_GROUPS; ++g) {
+        codec_destroy(&compressors[g]);
+    }
+    free(spool_path);
+    free_topics(&topics);
+    free(availability_topic.str);
+    arena_destroy(&aircraft_arena);
+    pbfile_destroy(&aircraft_file);
+    free(server_uri);
+    free(client_id);
+    settings_free(&active_settings);
+    settings_free(&base_settings);
+    free(config_path);
+    free(polar_max_file);
+    if (inotify_fd != -1) {
+        close(inotify_fd);
+    }
+    if (signal_fd != -1) {
+        close(signal_fd);
+    }
+    if (timer_fd != -1) {
+        close(timer_fd);
+    }
+    if (broker_timer_fd != -1) {
+        close(broker_timer_fd);
+    }
+    if (epoll_fd != -1) {
+        close(epoll_fd);
+    }
+    if (broker_fd != -1) {
+        close(broker_fd);
+    }
+    if (decode_fd != -1) {
+        close(decode_fd);
+    }
+    if (decoded_fd != -1) {
+        close(decoded_fd);
+    }
+    // Failures of messages drained on shutdown
+    if (atomic_load(&publish_failed)) {
+        app_return_code = EXIT_FAILURE;
+    }
+    return app_return_code;
+}
@@ -31,19 +31,107 @@
 #include <inttypes.h>
 #include <sys/stat.h>
 #include <sys/inotify.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <errno.h>
+#include <time.h>
 #include <stdint.h>
+#include <limits.h>
 #include <fcntl.h>
-#include <MQTTClient.h>
+#include <stdatomic.h>
+#include <poll.h>
+#include <pthread.h>
+#include <MQTTAsync.h>
 #include "readsb.pb-c.h"
+#include "arena.h"
+#include "pbfile.h"
+#include "json.h"
+#include "fmt.h"
+#include "aircraft.h"
+#include "sensor.h"
+#include "polar.h"
+#include "metrics.h"
+#include "exporter.h"
+#include "spool.h"
+#include "codec.h"
+#include "mailbox.h"
+#include "config.h"
 
-static const char *READSB_STATS_FILE_PB = "/run/readsb/stats.pb";
+static const char *READSB_DIR = "/run/readsb";
+static const char *READSB_STATS_FILE_PB = "stats.pb";
+static const char *READSB_AIRCRAFT_FILE_PB = "aircraft.pb";
 
 #define NOTUSED(V) ((void) V)
 
 #define QOS         1
 #define TIMEOUT     10000L
+#define INFLIGHT_WINDOW     32      // Default number of unacknowledged messages
+#define MAX_INFLIGHT_WINDOW 65535
+#define STATS_ARENA_SIZE    4096    // Initial arena size for stats.pb unpacking, grows to peak
+#define AIRCRAFT_ARENA_SIZE (256 * 1024) // Initial arena size for aircraft.pb unpacking
+#define AIRCRAFT_QOS        0       // Aircraft state is refreshed every second, no need to acknowledge
+#define STATS_FIELD_LAST_1MIN 2     // Field numbers in Statistics message
+#define STATS_FIELD_TOTAL   5
+#define STATS_FIELD_POLAR_RANGE 6
+#define STATS_MAX_FIELD     6
+#define POLAR_SAVE_INTERVAL 300     // Min. seconds between writes of the all-time polar range file
+#define NUM_STATS_WINDOWS   5
+#define MAX_RECEIVERS       64
+#define MAX_FIELD_ARGS      64
+#define MAX_DEADBANDS       64
+#define HEARTBEAT_INTERVAL  300     // Default max. seconds without publishing a sensor
+#define SNAPSHOT_INTERVAL   900     // Default seconds between full properties
 #define BUF_LEN (10 * (sizeof(struct inotify_event) + NAME_MAX + 1))
 
+// Event loop
+#define MAX_EVENTS          8
+#define TIMER_INTERVAL      10  // Seconds between periodic connection and staleness checks
+#define STATS_STALE_TIMEOUT 90  // Seconds without new stats.pb before feeder is reported as not running
+
+// Reconnect and offline queue
+#define RECONNECT_MIN_MS    1000    // First reconnect delay, doubles per attempt
+#define RECONNECT_MAX_MS    60000
+#define SPOOL_SIZE          16      // Default maximum queue file size in MiB
+#define SPOOL_BATCH         20      // Queued messages flushed per tick after reconnect
+#define SPOOL_FLUSH_MS      100     // Milliseconds between flush ticks
+#define SPOOL_MEMORY        4       // MiB of messages waiting for the in-flight window without queue file
+
+// Broker connection state, owned by the event loop
+enum {
+    BROKER_CONNECTING,
+    BROKER_CONNECTED,
+    BROKER_DISCONNECTED // Waiting for reconnect timer
+};
+
+// Event sources registered in epoll, stored in epoll_event.data.u32
+enum {
+    EV_INOTIFY = 1,
+    EV_SIGNAL,
+    EV_TIMER,
+    EV_BROKER,
+    EV_BROKER_TIMER,
+    EV_DECODED,
+    EV_EXPORTER // Exporter connections follow
+};
+
+// Statistics windows served by the exporter, values of a receiver are kept in this order
+enum {
+    EXPORT_LAST_1MIN,
+    EXPORT_TOTAL,
+    NUM_EXPORT_WINDOWS
+};
+
+// Topic groups that can be compressed, index matches compress_groups
+enum {
+    COMPRESS_RAW, // raw/stats and raw/aircraft
+    COMPRESS_AIRCRAFT, // aircraft/<hex> and aircraft_stats
+    COMPRESS_WINDOWS, // stats/<window>
+    COMPRESS_POLAR, // polar_range and polar_range_max
+    NUM_COMPRESS_GROUPS
+};
+
 // For string length limitations see MQTT v3.1.1, the connect packet
 #define MAX_URI_SIZE        65535
 #define MAX_AUTH_SIZE       65535
@@ -55,60 +143,307 @@ const char *argp_program_bug_address = "";
 static error_t parse_opt(int key, char *arg, struct argp_state *state);
 
 static struct argp_option options[] = {
+    {"config", 'c', "<file>", 0, "Read settings from this file and apply changes at runtime, see README for the settings allowed", 1},
     {"broker", 'b', "<URI>", 0, "MQTT broker URI (default: tcp://localhost:1883)", 1},
     {"user", 'u', "<username>", 0, "MQTT broker auth username", 1},
     {"pass", 'p', "<password>", 0, "MQTT broker auth password", 1},
     {"id", 'i', "<clientid>", 0, "MQTT unique client id (default: feeder001)", 1},
     {"topic", 't', "<topic>", 0, "MQTT topic prefix (default: homeassistant/sensor)", 1},
+    {"inflight", 'w', "<n>", 0, "Maximum number of unacknowledged MQTT messages (default: 32)", 1},
+    {"hass-status", 's', "<topic>", 0, "HASS birth message topic (default: homeassistant/status)", 1},
+    {"receiver", 'r', "<dir>[=<clientid>]", 0, "Readsb stats directory, client id defaults to --id (repeatable, default: /run/readsb)", 1},
+    {"aircraft", 'a', 0, 0, "Publish state of tracked aircraft from aircraft.pb", 1},
+    {"raw", 'R', 0, 0, "Publish stats.pb and aircraft.pb unchanged to binary topics raw/stats and raw/aircraft", 1},
+    {"deadband", 'd', "<id>=<abs>[:<rel%>]", 0, "Publish sensor only when changed by more than the larger of absolute and relative deadband, id * for all sensors (repeatable)", 1},
+    {"heartbeat", 'H', "<seconds>", 0, "Publish unchanged sensor after this time (default: 300, 0 disables)", 1},
+    {"export", 'e', "<field>", 0, "Export only this statistics field or sensor id (repeatable, default: all)", 1},
+    {"exclude", 'x', "<field>", 0, "Do not export this statistics field or sensor id (repeatable)", 1},
+    {"window", 'W', "<window>=<seconds>", 0, "Publish statistics window latest, last_1min, last_5min, last_15min or total to its own topic at this interval, 0 on every update (repeatable)", 1},
+    {"polar", 'P', 0, 0, "Publish polar range, changed bins only after a full frame", 1},
+    {"polar-max", 'M', "<file>", 0, "Merge polar range into all-time maximum kept in this file and publish it", 1},
+    {"snapshot", 'S', "<seconds>", 0, "Publish all sensors after this time (default: 900, 0 disables)", 1},
+    {"diagnostics", 'D', "<seconds>", 0, "Publish own pipeline metrics at this interval (default: 0, disabled)", 1},
+    {"compress", 'z', "<group>[:<codec>][=<level>]", 0, "Compress payloads of topic group raw, aircraft, windows or polar, codec zlib (default), level 1-9 (default: 6) (repeatable)", 1},
+    {"queue", 'Q', "<file>[=<MiB>]", 0, "Queue messages in this file while disconnected from the broker, flushed in order after reconnect (default size: 16 MiB)", 1},
+    {"exporter", 'E', "[<host>:]<port>", 0, "Serve latest statistics as OpenMetrics at http://<host>:<port>/metrics", 1},
     { 0}
 };
 
-static const char *MQTT_SENSOR_CONFIG =
-        "{"
-        "\"name\":\"%s %s\","
-        "\"unique_id\":\"%s.%s\","
-        "\"state_topic\":\"%s/%s/properties\","
-        "\"val_tpl\":\"{{value_json.%s}}\","
-        "\"icon\":\"%s\","
-        "\"platform\":\"mqtt\","
-        "\"unit_of_measurement\":\"%s\""
-        "}\0";
-
-static const char *MQTT_STATUS_CONFIG =
-        "{"
-        "\"name\":\"%s Status\","
-        "\"unique_id\":\"%s.running\","
-        "\"device_class\": \"running\","
-        "\"state_topic\":\"%s/%s/properties\","
-        "\"val_tpl\":\"{{value_json.running}}\","
-        "\"payload_on\":\"1\","
-        "\"payload_off\":\"0\","
-        "\"platform\":\"mqtt\""
-        "}\0";
+// HASS sensor icon
+static const char *MQTT_SENSOR_ICON = "mdi:airplane";
+
+// HASS birth and last will payload announcing HASS is online
+static const char *HASS_STATUS_ONLINE = "online";
+
+// Availability payloads of this client, HASS defaults of payload_available and payload_not_available
+static const char *MQTT_AVAILABLE = "online";
+static const char *MQTT_NOT_AVAILABLE = "offline";
 
 // HASS auto discover: <discovery_prefix>/<component>/[<node_id>/]<object_id>/config
 static const char *MQTT_TOPIC_CONFIG = "%s/%s/%s/config\0";
 static const char *MQTT_TOPIC_PROPERTIES = "%s/%s/properties\0";
+static const char *MQTT_TOPIC_AVAILABILITY = "%s/%s/availability\0";
+static const char *MQTT_TOPIC_AIRCRAFT = "%s/%s/aircraft/\0"; // Followed by aircraft hex address
+static const char *MQTT_TOPIC_AIRCRAFT_STATS = "%s/%s/aircraft_stats\0";
+static const char *MQTT_TOPIC_POLAR = "%s/%s/polar_range\0";
+static const char *MQTT_TOPIC_POLAR_MAX = "%s/%s/polar_range_max\0";
+static const char *MQTT_TOPIC_WINDOW = "%s/%s/stats/%s\0"; // Followed by window name
+static const char *MQTT_TOPIC_DIAGNOSTICS = "%s/%s/diagnostics\0";
+static const char *MQTT_TOPIC_RAW = "%s/%s/raw/%s\0"; // Followed by stats or aircraft, readsb.proto encoded
+
+// Metadata of StatisticEntry fields, all other numeric fields are exported
+// with a name derived from the field. Ids of the first entries are kept
+// from earlier versions, so existing HASS entities stay.
+static const struct sensor_meta sensor_meta[] = {
+    {"start", NULL, NULL, NULL, 0, -1, 1},
+    {"stop", NULL, NULL, NULL, 0, -1, 1},
+    {"messages", "messages", "Messages", "Messages", 0, -1, 0},
+    {"tracks_new", "tracks_new", "Tracking", "Aircraft", 0, -1, 0},
+    {"tracks_single_message", "tracks_single", "Single", "Aircraft", 0, -1, 0},
+    {"tracks_mlat_position", "tracks_mlat", "MLAT", "Aircraft", 0, -1, 0},
+    {"tracks_with_position", "tracks_position", "Positions", "Aircraft", 0, -1, 0},
+    {"max_distance_in_metres", "max_dist_metric", "Maximum Distance Metric", "km", 0.001, 1, 0},
+    {"max_distance_in_nautical_miles", "max_dist_imp", "Maximum Distance Imperial", "nm", 0, -1, 0},
+    {"local_strong_signals", "local_strong", "Strong Signals", "Messages", 0, -1, 0},
+    {"local_signal", "local_signal", "Signal", "dBFS", 0, -1, 0},
+    {"local_noise", "local_noise", "Noise", "dBFS", 0, -1, 0},
+    {"local_peak_signal", "local_peak", "Peak", "dBFS", 0, -1, 0},
+    {"tracks_", NULL, NULL, "Aircraft", 0, -1, 0},
+    {"cpu_", NULL, NULL, "ms", 0, -1, 0},
+    {"local_samples_", NULL, NULL, "Samples", 0, -1, 0},
+    {"cpr_", NULL, NULL, "Messages", 0, -1, 0},
+    {"remote_", NULL, NULL, "Messages", 0, -1, 0},
+    {"local_", NULL, NULL, "Messages", 0, -1, 0},
+    {"altitude_suppressed", NULL, "Altitude suppressed", "Messages", 0, -1, 0},
+    {"temperatur", NULL, "Temperature", "°C", 0, 1, 0}, // External, read from hwmon
+    {NULL, NULL, NULL, NULL, 0, 0, 0}
+};
+
+// String with known length, built once at startup
+struct interned {
+    char *str;
+    int len;
+};
+
+// Payloads and strings built from the settings, rebuilt when sensors or topic prefix change
+struct topic_table {
+    struct interned offline;
+    struct interned diagnostics_topic;
+    struct interned *sensor_keys; // Properties JSON key, quoted and with colon, index matches sensor table
+    int num_sensors;
+};
+
+// Settings changed by a config file reload, see settings_changes()
+enum {
+    CHANGED_CREDENTIALS = 1 << 0,
+    CHANGED_PREFIX = 1 << 1,
+    CHANGED_HASS_STATUS = 1 << 2,
+    CHANGED_SENSORS = 1 << 3,
+    CHANGED_DEADBANDS = 1 << 4,
+    CHANGED_WINDOWS = 1 << 5,
+    CHANGED_INTERVALS = 1 << 6
+};
+
+/*
+ * Settings that can be changed at runtime by the config file. The
+ * settings in use own all strings, the globals of the same name point
+ * into them. Settings in the file override the command line, repeatable
+ * settings in the file replace those given on the command line.
+ */
+struct settings {
+    char *username;
+    char *password;
+    char *topic_prefix;
+    char *hass_status_topic;
+    int heartbeat_interval;
+    int snapshot_interval;
+    int diagnostics_interval;
+    int window_intervals[NUM_STATS_WINDOWS];
+    char *deadband_args[MAX_DEADBANDS];
+    int num_deadbands;
+    char *export_args[MAX_FIELD_ARGS];
+    int num_exports;
+    char *exclude_args[MAX_FIELD_ARGS];
+    int num_excludes;
+};
+
+// Settings being loaded from the config file
+struct config_load {
+    struct settings *settings;
+    int deadbands; // Set once the command line list is replaced
+    int exports;
+    int excludes;
+    int windows;
+};
 
-static struct {
-    const char *id;
+// Topics and discovery payloads of one receiver, built at startup and on
+// topic prefix, sensor or window change
+struct receiver_topics {
+    struct interned properties_topic;
+    struct interned status_config_topic;
+    struct interned status_config;
+    struct interned *config_topics; // Per sensor, index matches sensor table
+    struct interned *configs;
+    int num_configs;
+    struct interned aircraft_topic; // Prefix, aircraft address is appended
+    struct interned aircraft_stats_topic;
+    struct interned polar_topic;
+    struct interned polar_max_topic;
+    struct interned window_topics[NUM_STATS_WINDOWS]; // Index matches stats_windows
+    struct interned raw_stats_topic;
+    struct interned raw_aircraft_topic;
+};
+
+// Statistics window published to its own topic
+struct stats_window {
     const char *name;
-    const char *unit;
-    double val;
-} statistics[] = {
-    {"messages", "Messages", "Messages", 0},
-    {"tracks_new", "Tracking", "Aircraft", 0},
-    {"tracks_single", "Single", "Aircraft", 0},
-    {"tracks_mlat", "MLAT", "Aircraft", 0},
-    {"tracks_position", "Positions", "Aircraft", 0},
-    {"max_dist_metric", "Maximum Distance Metric", "km", 0},
-    {"max_dist_imp", "Maximum Distance Imperial", "nm", 0},
-    {"local_strong", "Strong Signals", "Messages", 0},
-    {"local_signal", "Signal", "dBFS", 0},
-    {"local_noise", "Noise", "dBFS", 0},
-    {"local_peak", "Peak", "dBFS", 0},
-    {"temperatur", "Temperature", "°C", 0},
-    {NULL, NULL, NULL, 0}
+    unsigned field; // Field number in Statistics message
+    int interval; // Seconds between publishes, 0 on every update, -1 disabled
+};
+
+// Publishing state of a statistics window per receiver
+struct window_state {
+    time_t last_sent; // Zero when never published
+    StatisticEntry *msg; // Decoded when due, until published
+};
+
+// Polar range publishing state per receiver
+struct polar_state {
+    struct polar_map current;
+    struct polar_map sent;
+    struct polar_map max;
+    char *max_file; // NULL when all-time maximum is not kept
+    int new;
+    int full_pending;
+    int max_pending;
+    int max_dirty;
+    time_t last_full;
+    time_t last_save;
+};
+
+// Delta publishing state per sensor, index matches sensor table
+struct sensor_state {
+    double abs_deadband;
+    double rel_deadband; // Fraction of last published value
+    double sent; // Last published value
+    time_t sent_time; // Zero when never published
+    int pending; // In the payload being published, see commit_properties()
+};
+
+static struct stats_window stats_windows[NUM_STATS_WINDOWS] = {
+    {"latest", 1, -1},
+    {"last_1min", STATS_FIELD_LAST_1MIN, -1},
+    {"last_5min", 3, -1},
+    {"last_15min", 4, -1},
+    {"total", STATS_FIELD_TOTAL, -1}
+};
+
+// Ownership of a stats frame, changed only by atomic exchange
+enum {
+    FRAME_FREE,
+    FRAME_WRITING, // Decode worker reads and decodes into it
+    FRAME_READY, // Decoded, waiting for the event loop
+    FRAME_HELD // Event loop publishes from it
+};
+
+/*
+ * Decoded stats.pb of a receiver. Each receiver has two frames, so the
+ * decode worker fills one while the event loop publishes from the other.
+ * A frame is owned by one thread at a time, its state tells which.
+ * File content stays valid while the frame is held, for raw passthrough,
+ * polar range and windows decoded on demand.
+ */
+struct stats_frame {
+    atomic_int state;
+    uint64_t notified_us; // Time stats.pb replacement was seen
+    struct pbfile file;
+    struct arena arena;
+    const uint8_t *data;
+    size_t len;
+    struct pbfile_field fields[STATS_MAX_FIELD + 1];
+    StatisticEntry *last_1min;
+    int has_temperature;
+    double temperature; // Degrees Celsius, read with the frame
+};
+
+/*
+ * One readsb instance with its own stats directory and client id namespace.
+ * All receivers share the sensor table and MQTT session. An extra receiver
+ * costs its topics, values and sensor states, and two stats frames, each
+ * with an arena grown to the peak of one stats.pb and the mapped file.
+ */
+struct receiver {
+    char *dir;
+    char *client_id;
+    char *stats_path;
+    char *aircraft_path;
+    int wd; // Inotify watch descriptor
+    int publish_pending; // Properties need to be published
+    int feeder_status;
+    int running_sent;
+    int snapshot_pending;
+    time_t last_snapshot;
+    uint64_t last_timestamp;
+    time_t last_stats_time;
+    struct mailbox stats_mailbox; // stats.pb replaced, taken by decode worker
+    struct mailbox aircraft_mailbox; // aircraft.pb replaced, taken by event loop
+    struct stats_frame frames[2];
+    struct stats_frame *held; // Frame published from in this loop pass, NULL when none
+    double *values; // Index matches sensor table
+    struct sensor_state *sensor_states;
+    struct receiver_topics topics;
+    struct window_state windows[NUM_STATS_WINDOWS];
+    struct polar_state *polar; // NULL when polar range is not published
+    double *export_values; // Per export window, index matches export table, NULL without exporter
+    unsigned export_mask; // Export windows present in the last update
+    struct aircraft_tracker aircraft_tracker;
+};
+
+// State of an in-flight window slot
+enum {
+    INFLIGHT_FREE,
+    INFLIGHT_BUSY, // Sent, waiting for the callback
+    INFLIGHT_ACKED,
+    INFLIGHT_FAILED
+};
+
+/*
+ * Slot in the publish in-flight window. Slots are used and freed in publish
+ * order by the event loop, callbacks only set the state. The callback context
+ * carries slot index and generation, a callback of a message whose slot was
+ * reset and reused since does not match the state and is ignored.
+ */
+struct inflight_msg {
+    atomic_uint state; // Generation << 2 | INFLIGHT_*
+    unsigned generation; // 16 bit, incremented per use
+    atomic_uint_fast64_t sent_us; // Time of publish, for ack latency
+    off_t spool_end; // Queued message committed when acknowledged, 0 when not queued
+    char topic[MAX_TOPIC_SIZE];
+};
+
+// Delivery accounting, updated from MQTT client thread
+struct publish_stats {
+    atomic_uint_fast64_t sent;
+    atomic_uint_fast64_t acked;
+    atomic_uint_fast64_t failed;
+    atomic_uint_fast64_t bytes;
+};
+
+/*
+ * Pipeline metrics of the stats path, from stats.pb replaced to broker ack.
+ * wait: inotify event until update starts, read: file I/O, decode: wire
+ * scan, unpack and sensor update, build: JSON payloads, ack: publish until
+ * acknowledged at QoS 1. Counters since start, no allocation on update.
+ */
+struct pipeline_metrics {
+    struct histogram wait;
+    struct histogram read;
+    struct histogram decode;
+    struct histogram build;
+    struct histogram ack;
+    uint64_t updates;
+    atomic_uint_fast64_t dropped; // stats.pb replaced again before processed, or unreadable
+    atomic_uint_fast64_t reconnects;
 };
 
 #endif /* READSBMQTT_H */
@@ -0,0 +1,293 @@
+// Part of readsbmqtt, an MQTT client that reads statistics from readsb
+// ADS-B decoder and forward them via MQTT broker into home assistant (HASS)
+//
+// sensor.c: Sensor table derived from protobuf message descriptor.
+//
+// Copyright (c) 2022 Michael Wolf <michael@mictronics.de>
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "sensor.h"
+
+/**
+ * Map protobuf field type to sensor storage kind.
+ * @param field Field descriptor.
+ * @return Storage kind, SENSOR_EXTERNAL when field is not a numeric scalar.
+ */
+static enum sensor_kind field_kind(const ProtobufCFieldDescriptor *field) {
+    if (field->label == PROTOBUF_C_LABEL_REPEATED) {
+        return SENSOR_EXTERNAL;
+    }
+    switch (field->type) {
+        case PROTOBUF_C_TYPE_UINT64:
+        case PROTOBUF_C_TYPE_FIXED64:
+            return SENSOR_U64;
+        case PROTOBUF_C_TYPE_INT64:
+        case PROTOBUF_C_TYPE_SINT64:
+        case PROTOBUF_C_TYPE_SFIXED64:
+            return SENSOR_I64;
+        case PROTOBUF_C_TYPE_UINT32:
+        case PROTOBUF_C_TYPE_FIXED32:
+            return SENSOR_U32;
+        case PROTOBUF_C_TYPE_INT32:
+        case PROTOBUF_C_TYPE_SINT32:
+        case PROTOBUF_C_TYPE_SFIXED32:
+        case PROTOBUF_C_TYPE_ENUM:
+            return SENSOR_I32;
+        case PROTOBUF_C_TYPE_FLOAT:
+            return SENSOR_FLOAT;
+        case PROTOBUF_C_TYPE_DOUBLE:
+            return SENSOR_DOUBLE;
+        case PROTOBUF_C_TYPE_BOOL:
+            return SENSOR_BOOL;
+        default:
+            return SENSOR_EXTERNAL;
+    }
+}
+
+/**
+ * Find metadata for field.
+ * @param meta Metadata table, terminated by NULL field.
+ * @param name Field name.
+ * @return Matching entry or NULL.
+ */
+static const struct sensor_meta *find_meta(const struct sensor_meta *meta, const char *name) {
+    for (; meta && meta->field; ++meta) {
+        size_t len = strlen(meta->field);
+        if (meta->field[len - 1] == '_' ? strncmp(meta->field, name, len) == 0 : strcmp(meta->field, name) == 0) {
+            return meta;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Check if field is named in list by field name or sensor id.
+ * @param list Names.
+ * @param n Number of names.
+ * @param field Field name.
+ * @param id Sensor id.
+ * @param used Marks matched names, may be NULL.
+ * @return Non zero when listed.
+ */
+static int listed(char **list, int n, const char *field, const char *id, int *used) {
+    int found = 0;
+    for (int i = 0; i < n; ++i) {
+        if (strcmp(list[i], field) == 0 || strcmp(list[i], id) == 0) {
+            if (used) {
+                used[i] = 1;
+            }
+            found = 1;
+        }
+    }
+    return found;
+}
+
+/**
+ * Derive display name from field name, "cpr_global_ok" becomes "Cpr global ok".
+ * @param dst Name buffer of SENSOR_NAME_SIZE.
+ * @param field Field name.
+ */
+static void derive_name(char *dst, const char *field) {
+    size_t i;
+    for (i = 0; field[i] && i < SENSOR_NAME_SIZE - 1; ++i) {
+        dst[i] = field[i] == '_' ? ' ' : field[i];
+    }
+    dst[i] = '\0';
+    if (dst[0] >= 'a' && dst[0] <= 'z') {
+        dst[0] = (char) (dst[0] - 'a' + 'A');
+    }
+}
+
+/**
+ * Fill sensor entry from field name and metadata.
+ * @param s Sensor entry.
+ * @param m Metadata or NULL.
+ * @param field Field name.
+ * @param id Sensor id.
+ * @param kind Storage kind.
+ * @param offset Offset of the field in the message.
+ */
+static void set_sensor(struct sensor *s, const struct sensor_meta *m, const char *field, const char *id,
+        enum sensor_kind kind, size_t offset) {
+    s->id = id;
+    s->unit = m ? m->unit : NULL;
+    if (m && m->name) {
+        snprintf(s->name, SENSOR_NAME_SIZE, "%s", m->name);
+    } else {
+        derive_name(s->name, field);
+    }
+    s->scale = m && m->scale != 0 ? m->scale : 1;
+    if (m && m->decimals >= 0) {
+        s->decimals = m->decimals;
+    } else {
+        s->decimals = kind == SENSOR_FLOAT || kind == SENSOR_DOUBLE || s->scale != 1 ? 1 : 0;
+    }
+    s->offset = offset;
+    s->kind = kind;
+}
+
+/**
+ * Build sensor table from all numeric scalar fields of a message type.
+ * Offsets and storage kinds are resolved here, so updates do not touch
+ * the descriptor again. Metadata entries naming no message field are
+ * external sensors, added after the fields when the caller provides them.
+ * @param table Table to initialize.
+ * @param desc Message descriptor.
+ * @param meta Field metadata, terminated by NULL field, may be NULL.
+ * @param external External sensors with a value now, by field name.
+ * @param num_external Number of external sensors.
+ * @param allow Export only these fields or ids, all when empty.
+ * @param num_allow Number of allowed names.
+ * @param deny Do not export these fields or ids.
+ * @param num_deny Number of denied names.
+ * @return Zero on success, -1 on unknown name or out of memory.
+ */
+int sensor_table_init(struct sensor_table *table, const ProtobufCMessageDescriptor *desc,
+        const struct sensor_meta *meta, char **external, int num_external,
+        char **allow, int num_allow, char **deny, int num_deny) {
+    int *used = calloc((size_t) (num_allow + num_deny + 1), sizeof (int));
+    int rc = 0;
+
+    table->count = 0;
+    table->size = (int) desc->n_fields + SENSOR_EXTERNAL_SLOTS;
+    table->entry = calloc((size_t) table->size, sizeof (struct sensor));
+    if (table->entry == NULL || used == NULL) {
+        free(used);
+        return -1;
+    }
+    for (unsigned i = 0; i < desc->n_fields; ++i) {
+        const ProtobufCFieldDescriptor *field = &desc->fields[i];
+        const struct sensor_meta *m = find_meta(meta, field->name);
+        enum sensor_kind kind = field_kind(field);
+        const char *id = m && m->id ? m->id : field->name;
+
+        int allowed = listed(allow, num_allow, field->name, id, used);
+        int denied = listed(deny, num_deny, field->name, id, used + num_allow);
+        if (kind == SENSOR_EXTERNAL || denied || (num_allow ? !allowed : m && m->hidden)) {
+            continue;
+        }
+        set_sensor(&table->entry[table->count++], m, field->name, id, kind, field->offset);
+    }
+    // Filtered like fields, so names are known even when the value is missing
+    for (const struct sensor_meta *m = meta; m && m->field; ++m) {
+        size_t len = strlen(m->field);
+        if (m->field[len - 1] == '_' || protobuf_c_message_descriptor_get_field_by_name(desc, m->field)) {
+            continue;
+        }
+        const char *id = m->id ? m->id : m->field;
+        int allowed = listed(allow, num_allow, m->field, id, used);
+        int denied = listed(deny, num_deny, m->field, id, used + num_allow);
+        if (!listed(external, num_external, m->field, id, NULL) || denied || (num_allow ? !allowed : m->hidden)) {
+            continue;
+        }
+        if (table->count == table->size) {
+            fprintf(stderr, "no slot for external sensor %s\n", m->field);
+            rc = -1;
+            break;
+        }
+        set_sensor(&table->entry[table->count++], m, m->field, id, SENSOR_EXTERNAL, 0);
+    }
+    for (int i = 0; i < num_allow + num_deny; ++i) {
+        if (!used[i]) {
+            fprintf(stderr, "unknown statistics field %s\n", i < num_allow ? allow[i] : deny[i - num_allow]);
+            rc = -1;
+        }
+    }
+    free(used);
+    return rc;
+}
+
+/**
+ * Read scaled value of a sensor field from message.
+ * @param s Sensor, external sensors read as 0.
+ * @param msg Message of the type the table was built from.
+ * @return Field value.
+ */
+double sensor_read(const struct sensor *s, const ProtobufCMessage *msg) {
+    const char *p = (const char *) msg + s->offset;
+    double v;
+    switch (s->kind) {
+        case SENSOR_U64:
+            v = (double) *(const uint64_t *) p;
+            break;
+        case SENSOR_I64:
+            v = (double) *(const int64_t *) p;
+            break;
+        case SENSOR_U32:
+            v = (double) *(const uint32_t *) p;
+            break;
+        case SENSOR_I32:
+            v = (double) *(const int32_t *) p;
+            break;
+        case SENSOR_FLOAT:
+            v = (double) *(const float *) p;
+            break;
+        case SENSOR_DOUBLE:
+            v = *(const double *) p;
+            break;
+        case SENSOR_BOOL:
+            v = *(const protobuf_c_boolean *) p ? 1 : 0;
+            break;
+        default:
+            return 0;
+    }
+    return v * s->scale;
+}
+
+/**
+ * Copy field values of message into value array.
+ * Values of external sensors are left unchanged.
+ * @param table Sensor table.
+ * @param msg Message of the type the table was built from.
+ * @param values Value per sensor, index matches table.
+ */
+void sensor_table_update(const struct sensor_table *table, const ProtobufCMessage *msg, double *values) {
+    for (int i = 0; i < table->count; ++i) {
+        const struct sensor *s = &table->entry[i];
+        if (s->kind != SENSOR_EXTERNAL) {
+            values[i] = sensor_read(s, msg);
+        }
+    }
+}
+
+/**
+ * Find sensor by id.
+ * @param table Sensor table.
+ * @param id Sensor id, need not be terminated.
+ * @param len Length of id.
+ * @return Index of sensor, -1 when not found.
+ */
+int sensor_table_find(const struct sensor_table *table, const char *id, size_t len) {
+    for (int i = 0; i < table->count; ++i) {
+        if (strlen(table->entry[i].id) == len && memcmp(table->entry[i].id, id, len) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Free sensor table.
+ * @param table Sensor table.
+ */
+void sensor_table_destroy(struct sensor_table *table) {
+    free(table->entry);
+    table->entry = NULL;
+    table->count = table->size = 0;
+}
@@ -0,0 +1,84 @@
+// Part of readsbmqtt, an MQTT client that reads statistics from readsb
+// ADS-B decoder and forward them via MQTT broker into home assistant (HASS)
+//
+// sensor.h: Sensor table derived from protobuf message descriptor. (header)
+//
+// Copyright (c) 2022 Michael Wolf <michael@mictronics.de>
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SENSOR_H
+#define SENSOR_H
+
+#include <stddef.h>
+#include <protobuf-c/protobuf-c.h>
+
+#define SENSOR_NAME_SIZE    48
+#define SENSOR_EXTERNAL_SLOTS   4
+
+// Storage type of a sensor field, resolved once from the descriptor
+enum sensor_kind {
+    SENSOR_EXTERNAL = 0, // Value is set by the caller, not read from the message
+    SENSOR_U64,
+    SENSOR_I64,
+    SENSOR_U32,
+    SENSOR_I32,
+    SENSOR_FLOAT,
+    SENSOR_DOUBLE,
+    SENSOR_BOOL
+};
+
+/*
+ * Optional metadata of a message field. Field names ending with '_' match
+ * as prefix, first match wins. Zero scale means 1, negative decimals are
+ * derived from the field type. A field not in the message describes an
+ * external sensor.
+ */
+struct sensor_meta {
+    const char *field;
+    const char *id; // NULL to use the field name
+    const char *name; // NULL to derive from the field name
+    const char *unit;
+    double scale;
+    int decimals;
+    int hidden; // Exported only when allowed explicitly
+};
+
+// Exported value, decimals 0 marks integer counters. Values are kept by the
+// caller, so one table serves several receivers.
+struct sensor {
+    const char *id;
+    const char *unit; // NULL when unitless
+    char name[SENSOR_NAME_SIZE];
+    int decimals;
+    double scale;
+    size_t offset; // Of the field in the message
+    enum sensor_kind kind;
+};
+
+struct sensor_table {
+    struct sensor *entry;
+    int count;
+    int size; // Message fields plus external slots
+};
+
+int sensor_table_init(struct sensor_table *table, const ProtobufCMessageDescriptor *desc,
+        const struct sensor_meta *meta, char **external, int num_external,
+        char **allow, int num_allow, char **deny, int num_deny);
+double sensor_read(const struct sensor *s, const ProtobufCMessage *msg);
+void sensor_table_update(const struct sensor_table *table, const ProtobufCMessage *msg, double *values);
+int sensor_table_find(const struct sensor_table *table, const char *id, size_t len);
+void sensor_table_destroy(struct sensor_table *table);
+
+#endif /* SENSOR_H */
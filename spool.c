@@ -0,0 +1,330 @@
+// Part of readsbmqtt, an MQTT client that reads statistics from readsb
+// ADS-B decoder and forward them via MQTT broker into home assistant (HASS)
+//
+// spool.c: Bounded append-only disk queue for messages while offline.
+//
+// Copyright (c) 2022 Michael Wolf <michael@mictronics.de>
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include "spool.h"
+
+#define SPOOL_MAGIC 0x5153  // "SQ"
+#define SPOOL_FILE_MAGIC 0x31515352 // "RSQ1"
+
+// File header in host byte order, followed by records
+struct spool_file_header {
+    uint32_t magic;
+    uint32_t reserved;
+    uint64_t commit_off; // Oldest message not committed
+};
+
+#define SPOOL_START ((off_t) sizeof (struct spool_file_header))
+
+// Record header in host byte order, followed by topic and payload
+struct spool_header {
+    uint16_t magic;
+    uint8_t qos;
+    uint8_t retained;
+    uint32_t topic_len;
+    uint32_t len;
+};
+
+/**
+ * Read bytes from file or memory.
+ * @return Zero on success, -1 on error.
+ */
+static int read_at(struct spool *s, void *buf, size_t len, off_t off) {
+    if (s->fd == -1) {
+        memcpy(buf, s->mem + off, len);
+        return 0;
+    }
+    return pread(s->fd, buf, len, off) == (ssize_t) len ? 0 : -1;
+}
+
+/**
+ * Read record header at offset.
+ * @return 1 when a complete record starts at offset, 0 at end or torn record.
+ */
+static int read_header(struct spool *s, off_t off, struct spool_header *h) {
+    if (s->write_off - off < (off_t) sizeof (*h) || read_at(s, h, sizeof (*h), off) == -1) {
+        return 0;
+    }
+    if (h->magic != SPOOL_MAGIC || h->topic_len > SPOOL_MAX_TOPIC || h->len > SPOOL_MAX_PAYLOAD) {
+        return 0;
+    }
+    return s->write_off - off >= (off_t) (sizeof (*h) + h->topic_len + h->len);
+}
+
+/**
+ * Truncate when all messages are committed.
+ */
+static void truncate_committed(struct spool *s) {
+    if (s->commit_off < s->write_off) {
+        return;
+    }
+    if (s->fd != -1 && ftruncate(s->fd, SPOOL_START) == -1) {
+        fprintf(stderr, "cannot truncate queue file: %s\n", strerror(errno));
+        return;
+    }
+    s->read_off = s->write_off = s->commit_off = SPOOL_START;
+    spool_sync(s);
+}
+
+/**
+ * Write commit offset to the file header when changed. Called once per
+ * flushed batch, so after a crash at most the messages committed since are
+ * sent again.
+ */
+void spool_sync(struct spool *s) {
+    struct spool_file_header fh = {SPOOL_FILE_MAGIC, 0, (uint64_t) s->commit_off};
+
+    if (s->fd == -1 || s->commit_off == s->synced_off) {
+        return;
+    }
+    if (pwrite(s->fd, &fh, sizeof (fh), 0) != (ssize_t) sizeof (fh)) {
+        fprintf(stderr, "cannot write queue file header: %s\n", strerror(errno));
+        return;
+    }
+    s->synced_off = s->commit_off;
+}
+
+/**
+ * Open spool file, messages left by a previous run are kept.
+ * @param s Spool.
+ * @param path File name, NULL to keep messages in memory.
+ * @param max_size Maximum file size in bytes.
+ * @return Zero on success, -1 on error.
+ */
+int spool_open(struct spool *s, const char *path, size_t max_size) {
+    struct spool_header h;
+    struct spool_file_header fh;
+
+    memset(s, 0, sizeof (*s));
+    s->max_size = max_size;
+    s->fd = -1;
+    s->write_off = s->read_off = s->commit_off = s->synced_off = SPOOL_START;
+    s->buf = malloc(SPOOL_MAX_TOPIC + 1 + SPOOL_MAX_PAYLOAD);
+    if (path == NULL) {
+        if (s->buf == NULL) {
+            fprintf(stderr, "cannot allocate queue: out of memory\n");
+            return -1;
+        }
+        return 0;
+    }
+    s->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (s->buf == NULL || s->fd == -1) {
+        fprintf(stderr, "cannot open queue file %s: %s\n", path, strerror(errno));
+        spool_close(s);
+        return -1;
+    }
+    off_t size = lseek(s->fd, 0, SEEK_END);
+    if (size < SPOOL_START || pread(s->fd, &fh, sizeof (fh), 0) != (ssize_t) sizeof (fh) || fh.magic != SPOOL_FILE_MAGIC) {
+        if (size > 0) {
+            fprintf(stderr, "queue file %s: unknown format, dropping %lld bytes\n", path, (long long) size);
+        }
+        fh.commit_off = (uint64_t) SPOOL_START;
+        size = SPOOL_START;
+    }
+    // Keep complete records only, a crash may have left a torn one.
+    s->write_off = size;
+    off_t off = SPOOL_START;
+    int commit_found = fh.commit_off == (uint64_t) off;
+    while (read_header(s, off, &h)) {
+        off += (off_t) (sizeof (h) + h.topic_len + h.len);
+        commit_found |= fh.commit_off == (uint64_t) off;
+    }
+    if (off != s->write_off) {
+        fprintf(stderr, "queue file %s: dropping %lld bytes of incomplete records\n", path, (long long) (s->write_off - off));
+        s->write_off = off;
+    }
+    if (ftruncate(s->fd, s->write_off) == -1) {
+        fprintf(stderr, "cannot truncate queue file %s: %s\n", path, strerror(errno));
+        spool_close(s);
+        return -1;
+    }
+    // Messages before the commit offset were acknowledged, an invalid offset keeps all.
+    s->read_off = s->commit_off = commit_found ? (off_t) fh.commit_off : SPOOL_START;
+    s->synced_off = -1;
+    truncate_committed(s);
+    spool_sync(s);
+    return 0;
+}
+
+/**
+ * Append message. Dropped when the file would exceed its maximum size.
+ * @return Zero on success, -1 when dropped.
+ */
+int spool_append(struct spool *s, const char *topic, const void *data, int len, int qos, int retained) {
+    size_t topic_len = strlen(topic);
+    struct spool_header h = {SPOOL_MAGIC, (uint8_t) qos, (uint8_t) retained, (uint32_t) topic_len, (uint32_t) len};
+    struct iovec iov[3] = {
+        {.iov_base = &h, .iov_len = sizeof (h)},
+        {.iov_base = (void *) topic, .iov_len = topic_len},
+        {.iov_base = (void *) data, .iov_len = (size_t) len}
+    };
+    size_t total = sizeof (h) + topic_len + (size_t) len;
+
+    if (s->buf == NULL || topic_len > SPOOL_MAX_TOPIC || len < 0 || len > SPOOL_MAX_PAYLOAD
+            || (size_t) s->write_off + total > s->max_size) {
+        s->dropped++;
+        return -1;
+    }
+    if (s->fd == -1) {
+        if ((size_t) s->write_off + total > s->mem_size) {
+            size_t size = s->mem_size ? s->mem_size : 65536;
+            while (size < (size_t) s->write_off + total) {
+                size *= 2;
+            }
+            uint8_t *mem = realloc(s->mem, size < s->max_size ? size : s->max_size);
+            if (mem == NULL) {
+                s->dropped++;
+                return -1;
+            }
+            s->mem = mem;
+            s->mem_size = size < s->max_size ? size : s->max_size;
+        }
+        for (int i = 0; i < 3; ++i) {
+            memcpy(s->mem + s->write_off, iov[i].iov_base, iov[i].iov_len);
+            s->write_off += (off_t) iov[i].iov_len;
+        }
+        return 0;
+    }
+    ssize_t n = pwritev(s->fd, iov, 3, s->write_off);
+    if (n != (ssize_t) total) {
+        // Cut off what was written, so the file stays a sequence of records.
+        if (n > 0 && ftruncate(s->fd, s->write_off) == -1) {
+            fprintf(stderr, "cannot truncate queue file: %s\n", strerror(errno));
+        }
+        s->dropped++;
+        return -1;
+    }
+    s->write_off += (off_t) total;
+    return 0;
+}
+
+/**
+ * @return Non zero when messages are waiting to be read back.
+ */
+int spool_pending(const struct spool *s) {
+    return s->read_off < s->write_off;
+}
+
+/**
+ * Read oldest message without removing it.
+ * @param s Spool.
+ * @param rec Returns message.
+ * @return 1 when a message is returned, 0 when empty, -1 on read error.
+ */
+int spool_peek(struct spool *s, struct spool_record *rec) {
+    struct spool_header h;
+
+    if (!spool_pending(s)) {
+        return 0;
+    }
+    // Payload at start of buffer, topic behind the largest payload
+    char *topic = (char *) s->buf + SPOOL_MAX_PAYLOAD;
+    off_t off = s->read_off + (off_t) sizeof (h);
+    if (!read_header(s, s->read_off, &h)
+            || read_at(s, topic, h.topic_len, off) == -1
+            || read_at(s, s->buf, h.len, off + (off_t) h.topic_len) == -1) {
+        return -1;
+    }
+    topic[h.topic_len] = '\0';
+    rec->topic = topic;
+    rec->data = s->buf;
+    rec->len = (int) h.len;
+    rec->qos = h.qos;
+    rec->retained = h.retained;
+    s->next_len = sizeof (h) + h.topic_len + h.len;
+    return 1;
+}
+
+/**
+ * Skip message returned by the last spool_peek(), it stays in the spool
+ * until committed.
+ */
+void spool_consume(struct spool *s) {
+    s->read_off += (off_t) s->next_len;
+    s->next_len = 0;
+}
+
+/**
+ * Remove messages up to offset, acknowledged by the broker.
+ * @param end Offset behind the last message to remove.
+ */
+void spool_commit(struct spool *s, off_t end) {
+    if (end > s->commit_off) {
+        s->commit_off = end;
+        truncate_committed(s);
+    }
+}
+
+/**
+ * Read back again from the oldest message not committed, sent messages were
+ * lost. A message rewound SPOOL_RETRIES times is dropped, so a message the
+ * broker refuses does not block the queue.
+ */
+void spool_rewind(struct spool *s) {
+    struct spool_header h;
+
+    if (s->read_off == s->commit_off) {
+        return;
+    }
+    if (s->commit_off != s->retry_off) {
+        s->retry_off = s->commit_off;
+        s->retries = 0;
+    }
+    if (++s->retries >= SPOOL_RETRIES && read_header(s, s->commit_off, &h)) {
+        s->commit_off += (off_t) (sizeof (h) + h.topic_len + h.len);
+        s->dropped++;
+    }
+    s->read_off = s->commit_off;
+    s->next_len = 0;
+    truncate_committed(s);
+}
+
+/**
+ * Drop all messages, used when the file cannot be read back.
+ */
+void spool_clear(struct spool *s) {
+    if (s->fd != -1 && ftruncate(s->fd, SPOOL_START) == -1) {
+        fprintf(stderr, "cannot truncate queue file: %s\n", strerror(errno));
+    }
+    s->read_off = s->write_off = s->commit_off = SPOOL_START;
+    s->next_len = 0;
+    spool_sync(s);
+}
+
+/**
+ * Close spool, messages not committed stay in the file.
+ */
+void spool_close(struct spool *s) {
+    if (s->fd != -1) {
+        spool_sync(s);
+        close(s->fd);
+    }
+    free(s->buf);
+    free(s->mem);
+    s->buf = NULL;
+    s->mem = NULL;
+    s->fd = -1;
+}
@@ -0,0 +1,79 @@
+// Part of readsbmqtt, an MQTT client that reads statistics from readsb
+// ADS-B decoder and forward them via MQTT broker into home assistant (HASS)
+//
+// spool.h: Bounded append-only disk queue for messages while offline. (header)
+//
+// Copyright (c) 2022 Michael Wolf <michael@mictronics.de>
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SPOOL_H
+#define SPOOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define SPOOL_MAX_TOPIC     65535
+#define SPOOL_MAX_PAYLOAD   (256 * 1024)
+#define SPOOL_RETRIES       5       // Times the oldest message is sent again before it is dropped
+
+// Record read by spool_peek(), valid until the next call
+struct spool_record {
+    const char *topic; // NUL terminated
+    const void *data;
+    int len;
+    int qos;
+    int retained;
+};
+
+/*
+ * Messages are appended to one file in publish order and read back in the
+ * same order. Nothing is rewritten: when the file reaches its maximum size
+ * new messages are dropped and counted. A message read back stays in the
+ * file until it is committed, acknowledged by the broker, and is read again
+ * after a rewind. The file is truncated once all messages are committed.
+ * The commit offset is kept in a file header, written by spool_sync(), so
+ * a restart does not send committed messages again. A file left by a previous run is validated on
+ * open, a torn last record is cut off, and its messages are kept.
+ * Without a file the records are kept in memory, same format and limit.
+ */
+struct spool {
+    int fd; // -1 in memory
+    uint8_t *mem; // Records in memory, grown up to max_size
+    size_t mem_size;
+    size_t max_size;
+    off_t write_off;
+    off_t read_off; // Next message to read back
+    off_t commit_off; // Oldest message not committed
+    off_t retry_off; // Oldest message when last rewound
+    int retries;
+    off_t synced_off; // Commit offset in the file header
+    size_t next_len; // Length of record returned by the last spool_peek()
+    uint64_t dropped;
+    uint8_t *buf;
+};
+
+int spool_open(struct spool *s, const char *path, size_t max_size);
+int spool_append(struct spool *s, const char *topic, const void *data, int len, int qos, int retained);
+int spool_pending(const struct spool *s);
+int spool_peek(struct spool *s, struct spool_record *rec);
+void spool_consume(struct spool *s);
+void spool_commit(struct spool *s, off_t end);
+void spool_rewind(struct spool *s);
+void spool_sync(struct spool *s);
+void spool_clear(struct spool *s);
+void spool_close(struct spool *s);
+
+#endif /* SPOOL_H */